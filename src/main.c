@@ -14,6 +14,8 @@
 #include "spi.h"
 #include "sysclk.h"
 #include "twi.h"
+#include "tc.h"
+#include "cycle_counter.h"
 
 // skeleton
 #include "types.h"
@@ -35,16 +37,98 @@
 #include "ii.h"
 
 
-#define FIRSTRUN_KEY 0x22
+// preset layout version. bumped once per release that changes what's stored,
+// not once per change, so a unit only loses its presets once for it.
+#define FIRSTRUN_KEY 0x23
 
 #define SHAPE_COUNT 5
 #define POT_HYSTERESIS 48
+#define ADC_OVERSAMPLE 4	// conversions summed per poll, 12 -> 14 bits
+#define ADC_K_MOVE 1		// one-pole shift while a pot moves
+#define ADC_K_IDLE 3		// and while it rests
+#define ADC_MOVE 48			// travel from where it last settled, 14 bit
+#define ADC_IDLE 24			// polls without movement before slowing down
+#define ADC_FAST 11			// poll period while moving, ms
+#define ADC_NOISE 4			// smallest change reported, 12 bit
 #define EVENTS_PER_PATTERN 128
 #define SLEW_CV_OFF_THRESH 4000
+// cvTimer period. slew lengths are counted in 5ms steps. the tick sends its
+// dac frames blocking from the soft timer interrupt, and at 1ms that cost
+// can't be measured without the device, so it stays at 2ms.
+#define CV_MS 2
+#define DAC_NOOP 0x80
+
+#define GATE_TC (&AVR32_TC)
+#define GATE_TC_CHANNEL 1	// channel 0 is the soft timer tick
+#define GATE_TC_IRQ AVR32_TC_IRQ1
+#define GATE_TC_IRQ_PRIORITY AVR32_INTC_INT3
+#define GATE_HZ (FPBA_HZ / 32)
+#define GATE_PER_8US (GATE_HZ / 125000)
+#define GATE_UNIT_US 10000	// fixed edge length step
+#define GATE_GAP_US 1000	// low time of a retrigger
+
+#define CAL_POINTS 17	// one every 256 dac codes
+#define CAL_KEY 0xa5
+
+#define TUNE_DEGREES 16	// custom tuning size
+#define TUNE_EDO_MAX 72
+
+#define PLAYHEADS 4
+#define PH_NEVER 0x7fffffff
+
+// pattern playback rate, 8.8 fixed point
+#define RATE_UNITY 256
+#define RATE_MIN 16
+#define RATE_MAX 4096
+
+// overdub capture ring, power of two
+#define DUB_EVENTS 64
+
+// external clock: default pulses per loop, tempo smoothing (1/2^n)
+#define EXT_PPL 16
+#define EXT_SMOOTH 3
+
+// ii clock ratio limit and groove templates
+#define RATIO_MAX 16
+#define GROOVES 6
+
+// song chain: steps of pattern and repeat count
+#define CHAIN_STEPS 16
+
+// undo history: records and the events they hold
+#define UNDO_DEPTH 16
+#define UNDO_EVENTS 160
+
+// transform chains, per preset
+#define XF_SLOTS 4
+#define XF_OPS 8
+#define XF_STRETCH_UNITY 16
+
+// outputs a playhead may drive
+#define OUT_PITCH 1
+#define OUT_GATE 2
+#define OUT_SHAPE 4
+#define OUT_ALL 7
 
 #define MIDI_NOTE_MAX 120
 #define MIDI_BEND_ZERO 0x2000  // 1 << 13
 #define MIDI_BEND_SLEW 15
+#define MIDI_BEND_RANGE 12     // semitones, 12 matches the old BEND1 table
+#define MIDI_BEND_RANGE_MAX 48
+#define MIDI_CC_LSB 32         // cc 0-31 msb, 32-63 lsb
+#define MIDI_CC_DATA 6
+#define MIDI_CC_NRPN_LSB 98
+#define MIDI_CC_NRPN_MSB 99
+#define MIDI_CC_RPN_LSB 100
+#define MIDI_CC_RPN_MSB 101
+
+#define SYSEX_MANUFACTURER 0x7d  // non-commercial
+#define SYSEX_DEVICE 0x45        // 'E'
+#define SYSEX_CHUNK 56           // raw bytes per message, 64 once packed
+#define SYSEX_RX_MAX 80
+#define SYSEX_PAGE 512           // flash page, writes are batched to this
+#define MIDI_CC_COUNT 128
+#define MIDI_CC_LEARN_NONE 0xff
 
 const u16 SHAPE_PATTERN[16] = {256, 288, 160, 384, 272, 292, 84, 448, 273, 432, 325, 168, 336, 276, 162};
 const u8 SHAPE_OFF_Y[9] = {0, 1, 1, 0, 0, 2, 2, 0, 0};
@@ -66,6 +150,17 @@ const u16 SEMI[128] = {
 	4164, 4198, 4232, 4266, 4300, 4334
 };
 
+// octave = 4096, 1/10 of a dac code
+// [int(round(math.log(r, 2) * 4096)) for r in ratios]
+// 5 limit: 1 16/15 9/8 6/5 5/4 4/3 45/32 3/2 8/5 5/3 9/5 15/8
+const u16 JUST[12] = {
+	0, 381, 696, 1077, 1319, 1700, 2015, 2396, 2777, 3019, 3473, 3715
+};
+// 1 256/243 9/8 32/27 81/64 4/3 729/512 3/2 128/81 27/16 16/9 243/128
+const u16 PYTH[12] = {
+	0, 308, 696, 1004, 1392, 1700, 2088, 2396, 2704, 3092, 3400, 3788
+};
+
 const u16 EXP[256] = {
 	0, 0, 0, 1, 2, 2, 3, 4, 5, 6, 7, 9, 10, 11, 13, 14, 16, 17, 19, 20, 22, 24,
 	25, 27, 29, 31, 33, 35, 37, 39, 41, 43, 45, 47, 49, 51, 54, 56, 58, 60, 63,
@@ -115,49 +210,62 @@ const u16 EXP2[128] = {
 	3481, 3540, 3600, 3660, 3721, 3782, 3844, 3906, 3969, 4032
 };
 
-// step = 4096.0 / (10 octave * 12.0 semitones per octave)
-// semi_per_octave = step * 12
-// bend_step = semi_per_octave / 512.0
-// [int(n * bend_step) for n in xrange(0,512)]
-const u16 BEND1[512] = {
-	0, 0, 1, 2, 3, 4, 4, 5, 6, 7, 8, 8, 9, 10, 11, 12, 12, 13, 14, 15, 16, 16, 17,
-	18, 19, 20, 20, 21, 22, 23, 24, 24, 25, 26, 27, 28, 28, 29, 30, 31, 32, 32,
-	33, 34, 35, 36, 36, 37, 38, 39, 40, 40, 41, 42, 43, 44, 44, 45, 46, 47, 48,
-	48, 49, 50, 51, 52, 52, 53, 54, 55, 56, 56, 57, 58, 59, 60, 60, 61, 62, 63,
-	64, 64, 65, 66, 67, 68, 68, 69, 70, 71, 72, 72, 73, 74, 75, 76, 76, 77, 78,
-	79, 80, 80, 81, 82, 83, 84, 84, 85, 86, 87, 88, 88, 89, 90, 91, 92, 92, 93,
-	94, 95, 96, 96, 97, 98, 99, 100, 100, 101, 102, 103, 104, 104, 105, 106, 107,
-	108, 108, 109, 110, 111, 112, 112, 113, 114, 115, 116, 116, 117, 118, 119,
-	120, 120, 121, 122, 123, 124, 124, 125, 126, 127, 128, 128, 129, 130, 131,
-	132, 132, 133, 134, 135, 136, 136, 137, 138, 139, 140, 140, 141, 142, 143,
-	144, 144, 145, 146, 147, 148, 148, 149, 150, 151, 152, 152, 153, 154, 155,
-	156, 156, 157, 158, 159, 160, 160, 161, 162, 163, 164, 164, 165, 166, 167,
-	168, 168, 169, 170, 171, 172, 172, 173, 174, 175, 176, 176, 177, 178, 179,
-	180, 180, 181, 182, 183, 184, 184, 185, 186, 187, 188, 188, 189, 190, 191,
-	192, 192, 193, 194, 195, 196, 196, 197, 198, 199, 200, 200, 201, 202, 203,
-	204, 204, 205, 206, 207, 208, 208, 209, 210, 211, 212, 212, 213, 214, 215,
-	216, 216, 217, 218, 219, 220, 220, 221, 222, 223, 224, 224, 225, 226, 227,
-	228, 228, 229, 230, 231, 232, 232, 233, 234, 235, 236, 236, 237, 238, 239,
-	240, 240, 241, 242, 243, 244, 244, 245, 246, 247, 248, 248, 249, 250, 251,
-	252, 252, 253, 254, 255, 256, 256, 257, 258, 259, 260, 260, 261, 262, 263,
-	264, 264, 265, 266, 267, 268, 268, 269, 270, 271, 272, 272, 273, 274, 275,
-	276, 276, 277, 278, 279, 280, 280, 281, 282, 283, 284, 284, 285, 286, 287,
-	288, 288, 289, 290, 291, 292, 292, 293, 294, 295, 296, 296, 297, 298, 299,
-	300, 300, 301, 302, 303, 304, 304, 305, 306, 307, 308, 308, 309, 310, 311,
-	312, 312, 313, 314, 315, 316, 316, 317, 318, 319, 320, 320, 321, 322, 323,
-	324, 324, 325, 326, 327, 328, 328, 329, 330, 331, 332, 332, 333, 334, 335,
-	336, 336, 337, 338, 339, 340, 340, 341, 342, 343, 344, 344, 345, 346, 347,
-	348, 348, 349, 350, 351, 352, 352, 353, 354, 355, 356, 356, 357, 358, 359,
-	360, 360, 361, 362, 363, 364, 364, 365, 366, 367, 368, 368, 369, 370, 371,
-	372, 372, 373, 374, 375, 376, 376, 377, 378, 379, 380, 380, 381, 382, 383,
-	384, 384, 385, 386, 387, 388, 388, 389, 390, 391, 392, 392, 393, 394, 395,
-	396, 396, 397, 398, 399, 400, 400, 401, 402, 403, 404, 404, 405, 406, 407,
-	408, 408
+// relative length of each step in a group of four, in 64ths
+const u8 GROOVE[GROOVES][4] = {
+	{ 64, 64, 64, 64 },	// straight
+	{ 72, 56, 72, 56 },	// 56% swing
+	{ 80, 48, 80, 48 },	// 62% swing
+	{ 85, 43, 85, 43 },	// triplet swing
+	{ 96, 32, 96, 32 },	// 75% swing
+	{ 64, 64, 80, 48 }	// swing on the second half only
 };
 
 typedef enum { eStandard, eFixed, eDrone } eEdge;
 typedef enum { mNormal, mSlew, mEdge, mSelect, mBank } eMode;
-typedef enum { rOff, rArm, rRec } rStatus;
+typedef enum { rOff, rArm, rRec, rDub } rStatus;
+typedef enum { phLoopPattern, phLoopOn, phLoopOff } ePhLoop;
+typedef enum { phClockInt, phClockII, phClockExt } ePhClock;
+typedef enum { arbLatest, arbLowest } eArb;
+typedef enum { xfEnd, xfReverse, xfRotate, xfQuantize, xfTranspose, xfInvert,
+	xfStretch, xfHumanize, xfThin, xfLinear, xfCount } eXform;
+
+// midi cc destinations. order matters: midi learn picks a destination with
+// (note % ccDestCount), so C unlearns, C# is cv a, D is cv b, etc.
+typedef enum { ccOff, ccA0, ccA1, ccA2, ccA3, ccSlew0, ccSlew1, ccSlew2, ccPort,
+	ccSustain, ccPattern, ccTrans, ccDestCount } eCcDest;
+typedef enum { ccLinear, ccLog, ccExp, ccCurveCount } eCcCurve;
+typedef enum { curveLin, curveRc, curveLog, curveExp, curveCount } eCurve;
+typedef enum { tunEdo, tunJust, tunPyth, tunCustom, tunCount } eTuning;
+
+// values ES_GET can read back
+typedef enum { snPlaying, snPattern, snPos, snLength, snTotal, snElapsed, snRate,
+	snPreset, snCv0, snCv1, snCv2, snCv3, snCount } eSnap;
+
+// slew shapes in 64 segments, 0 to 4096. curveLin needs no table
+const u16 CURVE[curveCount - 1][65] = {
+	// rc: 1 - e^-4x
+	{ 0, 253, 490, 713, 923, 1120, 1305, 1479, 1642, 1795, 1939, 2074, 2202, 2321,
+	2433, 2538, 2637, 2730, 2818, 2900, 2977, 3049, 3117, 3181, 3241, 3298, 3351,
+	3401, 3447, 3491, 3533, 3571, 3608, 3642, 3674, 3704, 3733, 3759, 3784, 3808,
+	3830, 3851, 3870, 3888, 3906, 3922, 3937, 3951, 3965, 3977, 3989, 4000, 4011,
+	4020, 4030, 4038, 4046, 4054, 4061, 4068, 4074, 4080, 4086, 4091, 4096 },
+	// log: log10(0.1 + 0.9x) + 1
+	{ 0, 234, 441, 626, 794, 947, 1088, 1219, 1341, 1455, 1562, 1663, 1759, 1849,
+	1936, 2018, 2097, 2172, 2244, 2314, 2381, 2445, 2507, 2567, 2625, 2682, 2736,
+	2789, 2841, 2891, 2939, 2986, 3033, 3077, 3121, 3164, 3206, 3247, 3286, 3325,
+	3364, 3401, 3438, 3473, 3509, 3543, 3577, 3610, 3643, 3675, 3706, 3737, 3767,
+	3797, 3826, 3855, 3884, 3912, 3939, 3966, 3993, 4019, 4045, 4071, 4096 },
+	// exp: e^4x - 1
+	{ 0, 5, 10, 16, 22, 28, 35, 42, 50, 58, 66, 76, 85, 96, 107, 119, 131, 145,
+	159, 174, 190, 208, 226, 245, 266, 288, 312, 337, 363, 392, 422, 454, 488,
+	525, 563, 605, 649, 695, 745, 798, 855, 915, 979, 1047, 1119, 1196, 1278,
+	1366, 1459, 1558, 1663, 1775, 1894, 2022, 2157, 2301, 2454, 2617, 2791, 2976,
+	3173, 3383, 3606, 3843, 4096 }
+};
+
+typedef enum { sxIdle, sxDump, sxLoad } eSysexState;
+typedef enum { sxRequest = 1, sxChunk, sxAck, sxNak, sxDone } eSysexCmd;
+typedef enum { sxPreset, sxPattern } eSysexKind;
 
 typedef struct {
 	u8 shape;
@@ -166,6 +274,30 @@ typedef struct {
 	u16 interval;
 } pattern_event_t;
 
+typedef struct {
+	u8 op;
+	s8 arg;
+} xform_t;
+
+typedef struct {
+	u8 shape;
+	u8 x;
+	u8 y;
+	u16 t;
+} dub_event_t;
+
+typedef struct {
+	u8 pattern;
+	u8 start;
+	u8 count;
+	u8 length;
+	u16 total_time;
+	u16 rate;
+	s8 x;
+	s8 y;
+	u8 at;
+} undo_t;
+
 typedef struct {
 	pattern_event_t e[EVENTS_PER_PATTERN];
 	u8 length;
@@ -173,19 +305,97 @@ typedef struct {
 	u8 loop;
 	s8 x;
 	s8 y;
+	u16 rate;
+	u8 mul;
+	u8 div;
+	u8 groove;
 } pattern_t;
 
 typedef struct {
+	u8 dest;
+	u8 curve;
+	u8 smooth;
+} cc_route_t;
+
+typedef struct {
+	u8 pattern;
+	u8 repeats;
+} chain_t;
+
+typedef struct {
+	u8 kind;		// eTuning
+	u8 edo;			// divisions of the octave for tunEdo
+	u8 degrees;		// tunCustom size
+	u8 row;			// scale steps from one grid row to the next
+	u32 scale;		// degrees the grid plays, 0 for all
+	u16 custom[TUNE_DEGREES];	// octave = 4096
+} tuning_t;
+
+typedef struct {
+	u8 state;
+	u8 kind;
+	u8 preset;
+	u8 pattern;
+	u16 seq;
+	u16 size;
+	u8 *flash;
+	u16 base;
+	u16 fill;
+	u8 page[SYSEX_PAGE];
+} sysex_xfer_t;
+
+typedef struct {
+	u8 playing;
+	u8 pattern;
+	u8 pos;
+	u8 loop;
+	u8 clock;
+	u8 out;
+	s8 x;
+	s8 y;
+	u32 offset;
+	u32 due;
+	u16 rem;
+	u16 xrate;
+	u16 xbase;
+	u8 divc;
+	u8 sub;
+	u8 subs;
+	u8 gstep;
+	u32 gstart;
+	u32 len8;
+	s32 sbase;
+} playhead_t;
+
+typedef struct {
+	u32 stamp;
+	u32 cand;
+	u32 period;
+	u32 odd;
+	u16 n;
+	u8 lock;
+	u8 fresh;
+} clk_est_t;
+
+typedef struct {
+	u32 f;		// filter state, 14.4
+	u16 m[2];	// previous sums for the median
+	u16 v;		// filtered, 12 bit
+	u16 out;	// last reported
+	u16 rest;	// where it last settled, 14 bit
 	u16 latch;
 	u8 hys;
+	u8 idle;
 } ain_t;
 
 typedef struct {
 	u16 now;
 	u16 target;
+	u16 from;
 	u16 slew;
 	u16 step;
-	s32 delta;
+	u8 curve;
+	s32 delta;	// 16.16 per update, or the phase step for a curve
 	u32 a;
 } aout_t;
 
@@ -210,13 +420,39 @@ typedef struct {
 	u8 help[16][8];
 
 	pattern_t p[16];
+
+	cc_route_t cc[MIDI_CC_COUNT];
+	u8 bend_range;
+	u8 midi_slew[4];
+
+	xform_t xf[XF_SLOTS][XF_OPS];
+
+	chain_t chain[CHAIN_STEPS];
+	u8 sw_div;
+
+	u8 curve[4];
+
+	tuning_t tune;
+	u8 quant;		// cv outputs 0-2 that quantize, one bit each
+	u32 qscale;		// degrees they quantize to, 0 for all
 } es_set;
 
+// per unit, ahead of the presets in flash so preset layout changes and a
+// firstrun reset leave it alone
+typedef struct {
+	u8 key;
+	s8 ofs[4];		// dac codes
+	s8 gain[4];		// 1/4096ths
+	s16 bp[4][CAL_POINTS];	// code sent for k * 256, before clamping
+} cal_t;
+
 typedef const struct {
 	u8 fresh;
 	u8 preset_select;
 	u8 glyph[8][8];
+	cal_t cal;
 	es_set es[8];
+	u8 scratch[sizeof(es_set)];	// sysex loads land here until checked
 } nvram_data_t;
 
 es_set es;
@@ -233,7 +469,13 @@ s16 shape_key_count;
 
 eMode mode;
 
-u16 edge_counter;
+
+// the preset's tuning resolved to cv, per midi note and per grid key
+u16 tune[128];
+u16 key_cv[8][16];
+
+// quantized cv for every 8 dac codes
+u16 qtab[512];
 u16 edge_state;
 
 u8 shape_counter;
@@ -241,7 +483,9 @@ u8 shape_counter;
 u8 clock_phase;
 
 u16 adc[4];
-u16 adc_last[4];
+u8 adc_slow = 61;
+u8 adc_ms;	// the adc timer's period
+u8 adc_primed;
 
 
 ain_t ain[3];
@@ -249,25 +493,49 @@ aout_t aout[4];
 
 u8 p_select, arp;
 
-u8 p_playing;
-u8 p_play_pos;
+playhead_t ph[PLAYHEADS];
+u32 ph_tick, ph_next;
+u8 ph_arb;
+u8 sw_pending, sw_pattern;
+u16 sw_at;
+u8 chain_on, chain_pos, chain_left;
+clk_est_t clk_jack, clk_ii;
+u8 ext_jack, ext_ppl;
+u16 seek_off[EVENTS_PER_PATTERN + 1];
+u8 seek_pattern, seek_valid;
 rStatus r_status;
 u8 arm_key;
 u8 selected;
 u16 rec_timer;
 u8 rec_position;
-u16 p_timer;
-u16 p_timer_total;
+dub_event_t dub[DUB_EVENTS];
+u8 dub_wr, dub_rd;
+u8 dub_pattern;
+u32 dub_cycles;	// longest a merge has held the clock timer off
+u8 dub_saved;
+volatile u8 dub_queued;
+undo_t undo[UNDO_DEPTH];
+pattern_event_t undo_ev[UNDO_EVENTS];
+u8 undo_first, undo_count, undo_pos, undo_used;
 u8 blinker;
 u8 all_edit;
-
-u8 clock_mode;
+volatile u8 magic_queued;	// grid magic shape for the main loop
+volatile u8 ph_hold;	// ii frames running, the playheads wait for them
 
 note_pool_t notes;
 u8 midi_legato;
 u8 sustain_active;
 s16 pitch_offset;
 u8 vel_shape, track_shape;
+u8 midi_active;
+u8 cc_learn, cc_learn_num;
+u8 cc_msb[MIDI_CC_LSB];
+u8 rpn_msb, rpn_lsb, rpn_nrpn;
+u32 bend_scale;
+
+sysex_xfer_t sysex;
+u8 sysex_rx[SYSEX_RX_MAX];
+u8 sysex_rx_len, sysex_rx_active;
 
 s8 move_x, move_y;
 
@@ -292,13 +560,62 @@ static nvram_data_t flashy;
 
 #define MAX_II_COUNT 8
 
-u8 i2c_waiting_count;
+// playhead ii commands: data[1] is the playhead, data[2] the value
+#define ES_PH_PLAY 16
+#define ES_PH_STOP 17
+#define ES_PH_TRANS 18
+#define ES_PH_LOOP 19
+#define ES_PH_CLOCK 20
+#define ES_PH_OUT 21
+#define ES_ARB 22
+#define ES_RATE 23
+#define ES_XF_ADD 24    // data[1] is slot << 4 | op, data[2] the argument
+#define ES_XF_CLEAR 25
+#define ES_XF_RUN 26
+#define ES_UNDO 27      // data[2] steps, 0 is one
+#define ES_REDO 28
+#define ES_SW_DIV 29    // 0 switches at once, 1 on the loop point, n on 1/n
+#define ES_CHAIN 30     // 0 stops, 1 starts from the first step
+#define ES_CHAIN_SET 31 // data[1] is the step, data[2] repeats << 4 | pattern
+#define ES_SEEK 32      // playhead 0 to pattern tick d
+#define ES_SEEK_FRAC 33 // playhead 0 to d / 16384 of the loop
+#define ES_PH_SEEK 34   // data[1] is the playhead, data[2] / 256 of the loop
+#define ES_EXT_PPL 35   // external clock pulses per loop
+#define ES_RATIO 36     // data[1] multiply, data[2] divide
+#define ES_GROOVE 37
+#define ES_GET 38       // read: data[1] picks the value (eSnap), two bytes back
+#define ES_CURVE 39     // data[1] is the output, data[2] the shape (eCurve)
+#define ES_TUNE 40      // data[1] eTuning, data[2] edo or custom degrees
+#define ES_TUNE_SET 41  // d is custom degree << 12 | offset, octave = 4096
+#define ES_SCALE 42     // data[1] byte of the degree mask, data[2] its bits
+#define ES_ROW 43       // scale steps between grid rows
+#define ES_CAL_OFS 44   // data[1] output, data[2] signed offset in dac codes
+#define ES_CAL_GAIN 45  // data[1] output, data[2] signed gain in 1/4096ths
+#define ES_CAL_POINT 46 // data[1] output << 5 | point, data[2] signed trim
+#define ES_CAL_SAVE 47
+#define ES_QUANT 48     // cv outputs 0-2 to quantize, one bit each
+#define ES_QSCALE 49    // data[1] byte of the degree mask, data[2] its bits
+
+// ii frames waiting for the main loop. the receive interrupt only writes
+// i2c_wr and check_events only moves i2c_rd. a frame is one 3 byte command
+// or a batch of up to four run back to back.
+#define I2C_QUEUE 8
+#define I2C_FRAME 12
 
 struct {
-	uint8_t waiting;
-	uint8_t cmd;
-	uint32_t data;
-} i2c_queue[8];
+	uint8_t l;
+	uint8_t data[I2C_FRAME];
+} i2c_queue[I2C_QUEUE];
+
+volatile u8 i2c_wr;
+u8 i2c_rd;
+// ES_CLOCK pulses stamped by the receive interrupt for the next clock tick to
+// step. the interrupt only moves ii_pulse_wr, the tick only ii_pulse_rd.
+volatile u8 ii_pulse_wr;
+u8 ii_pulse_rd;
+u16 ii_snap[snCount];
+u8 i2c_waiting_count;
+u16 i2c_overflow;
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -313,122 +630,1320 @@ static void clock(u8 phase);
 extern void timers_set_monome(void);
 extern void timers_unset_monome(void);
 
-// check the event queue
-static void check_events(void);
+// check the event queue
+static void check_events(void);
+
+// handler protos
+static void handler_None(s32 data) { ;; }
+static void handler_KeyTimer(s32 data);
+static void handler_Front(s32 data);
+static void handler_ClockNormal(s32 data);
+
+u8 flash_is_fresh(void);
+void flash_unfresh(void);
+void flash_write(void);
+void flash_read(void);
+
+static void shape(u8 s, u8 x, u8 y);
+static void pattern_shape(u8 s, u8 x, u8 y, u8 out);
+static void ph_step_due(playhead_t *h);
+
+void rec_arm(void);
+void rec_start(void);
+void rec_stop(void);
+void rec(u8 shape, u8 x, u8 y);
+void dub_start(void);
+void play(void);
+void stop(void);
+
+void ph_play(u8 n, u8 pattern);
+void ph_stop(u8 n);
+void ph_clock(u8 n, u8 clock);
+void ph_seek(u8 n, u16 t);
+
+void pattern_switch(u8 pattern);
+void chain_start(void);
+
+void pattern_linearize(void);
+void pattern_time_half(void);
+void pattern_time_double(void);
+void pattern_rate(u8 n, u16 rate);
+void pattern_transform(u8 n, const xform_t *xf);
+
+void undo_clear(void);
+void undo_push(u8 n, u8 start, u8 count);
+void pattern_undo(void);
+void pattern_redo(void);
+
+void reset_hys(void);
+
+
+static void es_ii_receive(uint8_t *data, uint8_t l);
+static void es_process_ii(uint8_t *data, uint8_t l);
+static void es_midi_process_ii(uint8_t *data, uint8_t l);
+
+
+void reset_hys() {
+	u8 i1;
+
+	for(i1=0;i1<3;i1++) {
+		ain[i1].hys = 0;
+		ain[i1].latch = ain[i1].out = ain[i1].v;
+	}
+}
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// application clock code
+
+// pulses are stamped with the cycle counter as they arrive, so tempo is
+// measured to well under a microsecond whatever the tick rate. the period is a
+// one-pole average; a pulse far off it is held back until the next one shows
+// whether it was a glitch or a new tempo. the jack and ES_CLOCK are measured
+// separately. playheads on the external clock follow it from the clock timer
+// (ext_follow), ii clocked ones space their sub-steps by it (ph_pulse).
+
+static void ext_pulse(clk_est_t *k, u32 now) {
+	u32 d = now - k->stamp;
+	u32 c = now - k->cand;
+	u32 p = k->period;
+
+	if(k->lock == 0) {
+		k->lock = 1;
+	}
+	else if(k->lock == 1) {
+		k->period = d;
+		k->lock = 2;
+	}
+	else if(d > (p << 2)) {
+		// stopped for a while, measure again
+		k->lock = 1;
+		k->odd = 0;
+	}
+	else if(k->odd && c > k->odd - (k->odd >> 3) && c < k->odd + (k->odd >> 3)) {
+		// two in a row agree on a new tempo, and the first of them counts
+		k->period = c;
+		k->odd = 0;
+		k->n++;
+	}
+	else if(d > p - (p >> 2) && d < p + (p >> 1)) {
+		k->period = p + ((s32)(d - p) >> EXT_SMOOTH);
+		k->odd = 0;
+	}
+	else {
+		k->odd = k->odd ? c : d;
+		k->cand = now;
+		return;
+	}
+
+	k->stamp = now;
+	k->n++;
+	k->fresh = 1;
+}
+
+// the jack when patched, otherwise ES_CLOCK
+static clk_est_t *ext_clk(void) {
+	return ext_jack ? &clk_jack : &clk_ii;
+}
+
+void clock(u8 phase) {
+	if(phase)
+		ext_pulse(&clk_jack, Get_sys_count());
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// timers
+
+static softTimer_t clockTimer = { .next = NULL, .prev = NULL };
+static softTimer_t keyTimer = { .next = NULL, .prev = NULL };
+static softTimer_t cvTimer = { .next = NULL, .prev = NULL };
+static softTimer_t adcTimer = { .next = NULL, .prev = NULL };
+static softTimer_t monomePollTimer = { .next = NULL, .prev = NULL };
+static softTimer_t monomeRefreshTimer  = { .next = NULL, .prev = NULL };
+static softTimer_t midiPollTimer = { .next = NULL, .prev = NULL };
+
+
+// values last sent to the dac, so only outputs that moved are written
+static u16 aout_sent[4] = { 0xffff, 0xffff, 0xffff, 0xffff };
+
+////////////////////////////////////////////////////////////////////////////////
+// dac calibration
+//
+// each output maps through CAL_POINTS breakpoints set from an offset and
+// gain, then optionally trimmed one by one. breakpoints sit 256 codes apart
+// so correcting a value is a shift, a mask and one multiply.
+
+cal_t cal;
+
+// breakpoints aren't clamped, so a negative offset keeps the bottom segment
+// on the line and only the code sent stops at 0
+static s16 cal_line(u8 c, u8 k) {
+	return (((s32)k * 256 * (4096 + cal.gain[c])) >> 12) + cal.ofs[c];
+}
+
+static void cal_reset(u8 c) {
+	u8 k;
+
+	for(k=0;k<CAL_POINTS;k++)
+		cal.bp[c][k] = cal_line(c, k);
+	aout_sent[c] = 0xffff;
+}
+
+static inline u16 cal_code(u8 c, u16 v) {
+	const s16 *b = cal.bp[c];
+	u8 n;
+	s32 r;
+
+	if(v > 4095)
+		v = 4095;
+	n = v >> 8;
+	r = b[n] + ((((s32)b[n + 1] - b[n]) * (v & 0xff)) >> 8);
+
+	return r < 0 ? 0 : r > 4095 ? 4095 : r;
+}
+
+static void cal_read(void) {
+	u8 c;
+
+	if(flashy.cal.key == CAL_KEY)
+		cal = flashy.cal;
+	else
+		for(c=0;c<4;c++) {
+			cal.ofs[c] = cal.gain[c] = 0;
+			cal_reset(c);
+		}
+}
+
+static void cal_write(void) {
+	cal.key = CAL_KEY;
+	flashc_memcpy((void *)&flashy.cal, &cal, sizeof(cal), true);
+}
+
+// the two dacs are daisy chained, each frame carries one word for the far
+// dac then one for the near one. outputs in frame order with their command.
+static const u8 DAC_MAP[4][2] = { { 2, 0x31 }, { 0, 0x31 }, { 3, 0x38 }, { 1, 0x38 } };
+
+// a word for an output that hasn't moved becomes a no-op and a frame with
+// nothing new isn't sent. returns whether anything went out.
+//
+// the clock timer can play a shape and write from its interrupt, so a write
+// from the main loop holds it off until both frames are out. from inside the
+// timer (or anything above it) the level is already masked and left so.
+static u8 aout_write(void) {
+	u8 b[6];
+	u8 f, i, n, o, sent, held;
+	u16 v;
+
+	held = cpu_irq_level_is_enabled(APP_TC_IRQ_PRIORITY);
+	if(held)
+		cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+
+	sent = 0;
+	for(f=0;f<4;f+=2) {
+		n = 0;
+		for(i=0;i<2;i++) {
+			o = DAC_MAP[f + i][0];
+			v = aout[o].now;
+			if(es.quant & (1 << o))
+				v = qtab[v > 4095 ? 511 : v >> 3];
+			if(v != aout_sent[o]) {
+				aout_sent[o] = v;
+				v = cal_code(o, v);
+				b[i*3] = DAC_MAP[f + i][1];
+				b[i*3+1] = v >> 4;
+				b[i*3+2] = v << 4;
+				n++;
+			}
+			else {
+				b[i*3] = DAC_NOOP;
+				b[i*3+1] = 0xff;
+				b[i*3+2] = 0xff;
+			}
+		}
+
+		if(n) {
+			spi_selectChip(SPI,DAC_SPI_NPCS);
+			for(i=0;i<6;i++)
+				spi_write(SPI,b[i]);
+			spi_unselectChip(SPI,DAC_SPI_NPCS);
+			sent = 1;
+		}
+	}
+
+	if(held)
+		cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+
+	return sent;
+}
+
+// slew lengths of each shape's cv outputs in cvTimer ticks, with 2^32 / ticks
+// to step by. a slew value that changes only marks its entry stale, and the
+// first shape change to use it works it out, so a pot sweep costs no divides
+// and a shape change is just loads after that.
+static u16 slew_steps[8][3];
+static u32 slew_inc[8][3];
+static u8 slew_stale[8];	// one bit per output
+
+// steps are 5ms long whatever the cvTimer rate, so slew times don't depend on it
+static u16 slew_ticks(u16 steps) {
+	steps = (steps * 5) / CV_MS;
+	return steps ? steps : 1;
+}
+
+// start a slew from where the output is now. a curve runs a phase across its
+// table instead of the value itself.
+static void slew_go(u8 i, u16 ticks, u32 inc, u8 curve) {
+	aout_t *o = &aout[i];
+	s64 d;
+
+	o->from = o->now;
+	o->curve = curve;
+	o->step = ticks;
+
+	// the step is rounded towards zero and the accumulator starts mid code,
+	// so a slew either way stops short of the target until its last tick
+	// instead of passing it and coming back
+	if(curve == curveLin) {
+		d = (s64)(o->target - o->now) * inc;
+		o->delta = d < 0 ? -((-d) >> 16) : d >> 16;
+		o->a = (o->now<<16) + 0x8000;
+	}
+	else {
+		o->delta = inc;
+		o->a = 0;
+	}
+}
+
+static void slew_start(u8 i, u16 steps, u8 curve) {
+	u16 t = slew_ticks(steps);
+	slew_go(i, t, 0xffffffff / t, curve);
+}
+
+static void slew_cache(u8 n, u8 i) {
+	u16 t = slew_ticks(EXP[es.slew[n][i] >> 4] + 1);
+
+	slew_steps[n][i] = t;
+	slew_inc[n][i] = 0xffffffff / t;
+	slew_stale[n] &= ~(1 << i);
+}
+
+// es.slew[n][i] has changed
+static inline void slew_touch(u8 n, u8 i) {
+	slew_stale[n] |= 1 << i;
+}
+
+static void slew_cache_all(void) {
+	u8 n, i;
+
+	for(n=0;n<8;n++)
+		for(i=0;i<3;i++)
+			slew_cache(n, i);
+}
+
+static inline u16 slew_curve(aout_t *o) {
+	const u16 *t = CURVE[o->curve - 1];
+	u32 p = o->a >> 10;
+	u8 n = p >> 16;
+	s32 c = t[n] + ((((s32)t[n + 1] - t[n]) * (s32)(p & 0xffff)) >> 16);
+
+	return o->from + ((((s32)o->target - o->from) * c) >> 12);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// gate timing
+//
+// fixed edges run on their own tc channel at a higher interrupt level than
+// the soft timers, so pulse widths don't depend on the tick or on what the
+// other timers are doing. a pulse longer than the 16 bit counter runs in
+// several compare periods. a retrigger drops the gate for GATE_GAP_US and
+// then starts the new pulse.
+
+typedef enum { gateIdle, gateGap, gateHigh } eGate;
+
+static volatile u8 gate_phase;
+static volatile u32 gate_left;	// counts after the current compare period
+static u32 gate_len;			// pulse to run after a retrigger gap
+
+static void gate_run(u32 counts) {
+	u16 rc = counts > 0xffff ? 0xffff : (counts ? counts : 1);
+
+	gate_left = counts - rc;
+	tc_write_rc(GATE_TC, GATE_TC_CHANNEL, rc);
+	tc_start(GATE_TC, GATE_TC_CHANNEL);
+}
+
+__attribute__((__interrupt__))
+static void gate_tc_irq(void) {
+	u16 rc;
+
+	tc_read_sr(GATE_TC, GATE_TC_CHANNEL);
+
+	if(gate_left) {
+		rc = gate_left > 0xffff ? 0xffff : gate_left;
+		gate_left -= rc;
+		tc_write_rc(GATE_TC, GATE_TC_CHANNEL, rc);
+		return;
+	}
+
+	tc_stop(GATE_TC, GATE_TC_CHANNEL);
+
+	if(gate_phase == gateGap) {
+		gpio_set_gpio_pin(B00);
+		edge_state = 1;
+		gate_phase = gateHigh;
+		gate_run(gate_len);
+	}
+	else {
+		gpio_clr_gpio_pin(B00);
+		edge_state = 0;
+		gate_phase = gateIdle;
+		monomeFrameDirty++;
+		// print_dbg("\r\ntrig done.");
+	}
+}
+
+static void gate_init(void) {
+	static const tc_waveform_opt_t opt = {
+		.channel = GATE_TC_CHANNEL,
+		.wavsel = TC_WAVEFORM_SEL_UP_MODE_RC_TRIGGER,
+		.tcclks = TC_CLOCK_SOURCE_TC4	// pba / 32
+	};
+	static const tc_interrupt_t irq = { .cpcs = 1 };
+
+	INTC_register_interrupt(&gate_tc_irq, GATE_TC_IRQ, GATE_TC_IRQ_PRIORITY);
+	tc_init_waveform(GATE_TC, &opt);
+	tc_configure_interrupts(GATE_TC, GATE_TC_CHANNEL, &irq);
+}
+
+// the gate interrupt has to be able to end a pulse while the clock timer is
+// playing the next one, and gate_pulse only unmasks what it masked
+#if GATE_TC_IRQ_PRIORITY <= APP_TC_IRQ_PRIORITY
+#error "the gate tc has to run above the soft timers"
+#endif
+
+// the counter is a whole number of counts every 8us, so this is one 32 bit
+// multiply. the longest fixed edge (2^14 steps) stays under 2^32.
+#if GATE_HZ % 125000
+#error "GATE_HZ isn't a whole number of counts per 8us"
+#endif
+
+static inline u32 gate_counts(u32 us) {
+	return (us * GATE_PER_8US) >> 3;
+}
+
+// raise the gate for us microseconds. a pulse that's already up is
+// retriggered: low for GATE_GAP_US, then the full new length. called from the
+// clock timer as well as the main loop, so the gate level is only masked and
+// unmasked here if it was enabled to begin with.
+static void gate_pulse(u32 us) {
+	u8 held = cpu_irq_level_is_enabled(GATE_TC_IRQ_PRIORITY);
+
+	if(held)
+		cpu_irq_disable_level(GATE_TC_IRQ_PRIORITY);
+
+	if(gate_phase == gateGap)
+		gate_len = gate_counts(us);
+	else if(gate_phase == gateHigh) {
+		tc_stop(GATE_TC, GATE_TC_CHANNEL);
+		gpio_clr_gpio_pin(B00);
+		edge_state = 0;
+		gate_len = gate_counts(us);
+		gate_phase = gateGap;
+		gate_run(gate_counts(GATE_GAP_US));
+	}
+	else {
+		gpio_set_gpio_pin(B00);
+		edge_state = 1;
+		gate_phase = gateHigh;
+		gate_run(gate_counts(us));
+	}
+
+	if(held)
+		cpu_irq_enable_level(GATE_TC_IRQ_PRIORITY);
+}
+
+// drop any pulse in flight without touching the gate
+static void gate_cancel(void) {
+	u8 held = cpu_irq_level_is_enabled(GATE_TC_IRQ_PRIORITY);
+
+	if(held)
+		cpu_irq_disable_level(GATE_TC_IRQ_PRIORITY);
+	tc_stop(GATE_TC, GATE_TC_CHANNEL);
+	gate_phase = gateIdle;
+	gate_left = 0;
+	if(held)
+		cpu_irq_enable_level(GATE_TC_IRQ_PRIORITY);
+}
+
+// hold the gate up, or let it go, whatever pulse was running
+static void gate_on(void) {
+	gate_cancel();
+	gpio_set_gpio_pin(B00);
+	edge_state = 1;
+}
+
+static void gate_off(void) {
+	gate_cancel();
+	gpio_clr_gpio_pin(B00);
+	edge_state = 0;
+}
+
+// runs every CV_MS in the timer interrupt. all four outputs are stepped first,
+// then aout_write sends what changed.
+static void cvTimer_callback(void* o) {
+	u8 i;
+
+	if(slew_active) {
+		for(i=0;i<4;i++) {
+			if(aout[i].step) {
+				if(--aout[i].step == 0)
+					aout[i].now = aout[i].target;
+				else if(aout[i].curve == curveLin) {
+					aout[i].a += aout[i].delta;
+					aout[i].now = aout[i].a >> 16;
+				}
+				else {
+					aout[i].a += (u32)aout[i].delta;
+					aout[i].now = slew_curve(&aout[i]);
+				}
+			}
+		}
+
+		if(aout_write())
+			monomeFrameDirty++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// pattern playback
+//
+// playheads run independently off the shared tick. each keeps the absolute
+// tick its next event is due and ph_next holds the earliest of them, so a tick
+// with nothing due costs one compare however many playheads are running.
+// playhead 0 is the one the grid plays, records and displays.
+//
+// due times chain from one event to the next and each loop starts exactly
+// where the last one ended. nothing is ever measured from "now", so a late
+// tick delays one event without shifting anything after it.
+//
+// intervals are in pattern ticks and are scaled by the pattern rate on the
+// way out: ticks = interval * 256 / rate, with the remainder carried to the
+// next event so any rate stays exact over any number of loops.
+
+static u8 ph_loops(playhead_t *h) {
+	if(h->loop == phLoopPattern)
+		return es.p[h->pattern].loop;
+	return h->loop == phLoopOn;
+}
+
+static u8 ph_outputs(u8 n) {
+	// arbLowest: a playing lower playhead owns the outputs it drives
+	u8 i, out = ph[n].out;
+
+	if(ph_arb == arbLowest)
+		for(i=0;i<n;i++)
+			if(ph[i].playing)
+				out &= ~ph[i].out;
+
+	return out;
+}
+
+// externally clocked playheads run at their own rate, the rest at the pattern's
+static u16 ph_rate(playhead_t *h) {
+	if(h->clock == phClockExt)
+		return h->xrate;
+	return es.p[h->pattern].rate;
+}
+
+// the wait left is left + rem / old ticks, or left * old + rem in pattern
+// ticks << 8. it's split again at the new rate, so changing the rate and
+// changing it back leaves the playhead where it was.
+static void ph_rescale(playhead_t *h, u16 old, u16 rate) {
+	s32 left = h->due - ph_tick;
+	u64 t;
+
+	if(left >= 0) {
+		t = (u64)left * old + h->rem;
+		h->due = ph_tick + (u32)(t / rate);
+		h->rem = t % rate;
+	}
+	else
+		h->rem = (u32)h->rem * rate / old;
+}
+
+static void ph_schedule(playhead_t *h) {
+	if((s32)(h->due - ph_next) < 0)
+		ph_next = h->due;
+}
+
+// playheads part way through a pattern that was just edited keep their place
+// in time rather than their event index
+static void ph_refit(u8 n) {
+	playhead_t *h;
+	u32 t;
+	u8 i, k;
+
+	for(i=0;i<PLAYHEADS;i++) {
+		h = &ph[i];
+		if(!h->playing || h->pattern != n || !h->pos)
+			continue;
+		for(k=0,t=0;k<es.p[n].length && t<h->offset;k++)
+			t += es.p[n].e[k].interval;
+		h->pos = k;
+	}
+}
+
+// overdub: shapes played over a running pattern are stamped with playhead 0's
+// position in the loop and queued in a ring (shape detection writes dub_wr,
+// the merge only moves dub_rd). at the loop point the timer asks the main
+// loop for a merge, which folds the queue into the pattern in one backward
+// pass, so the pattern is its own scratch buffer and the cost is linear in
+// events. the loop keeps its total time and playheads keep what they've
+// already played (dub_refit), so the due chain carries straight on into the
+// merged pattern.
+
+// where playhead h's next event lands once the n queued overdubs are merged:
+// after its last played event and every overdub stamped before that
+static u8 dub_before(playhead_t *h, u8 n) {
+	pattern_t *p = &es.p[dub_pattern];
+	u16 t, total = p->total_time;
+	u8 j, k;
+
+	if(!h->playing || h->pattern != dub_pattern || !h->pos)
+		return 0;
+
+	t = h->offset - p->e[h->pos - 1].interval;
+	for(j=0,k=h->pos;j<n;j++)
+		if(min(dub[(dub_rd + j) & (DUB_EVENTS - 1)].t, total) < t)
+			k++;
+
+	return k;
+}
+
+// move the playhead to merged event k. overdubs between its last event and
+// the one it was waiting on are now next, so the due time is moved back by
+// exactly their distance in pattern ticks, remainder included, and the old
+// event still lands on the tick it had.
+static void dub_refit(playhead_t *h, u8 k) {
+	pattern_t *p = &es.p[dub_pattern];
+	u32 t = 0;
+	s32 x, r;
+	u16 rate;
+	u8 i;
+
+	if(!k)
+		return;
+
+	for(i=0;i<k && i<p->length;i++)
+		t += p->e[i].interval;
+
+	if(k < p->length && t < h->offset && h->clock != phClockII) {
+		rate = ph_rate(h);
+		x = (h->offset - t) << 8;
+		r = (h->rem - x) % rate;
+		if(r < 0)
+			r += rate;
+		h->due -= (x + r - h->rem) / rate;
+		h->rem = r;
+		h->offset = t;
+	}
+	else if(k < p->length)
+		h->offset = t;
+
+	h->pos = k;
+	if(h->clock == phClockII)
+		ph_step_due(h);
+	ph_schedule(h);
+}
+
+// main loop only. the timer is held off while the pattern is rewritten, which
+// has to stay well inside one clock tick for a full pattern (dub_cycles).
+static void dub_merge(void) {
+	pattern_t *p = &es.p[dub_pattern];
+	dub_event_t *d;
+	u8 wr = dub_wr;
+	u8 n = (wr - dub_rd) & (DUB_EVENTS - 1);
+	u8 at[PLAYHEADS];
+	s16 i, j, o;
+	u16 ti, tn, td;
+	u32 c;
+
+	dub_queued = 0;
+
+	if(!n)
+		return;
+
+	// a full pattern keeps the earliest overdubs
+	if(n > EVENTS_PER_PATTERN - p->length)
+		n = EVENTS_PER_PATTERN - p->length;
+
+	// one undo step covers the whole pass. the merge only grows the
+	// pattern, so the events before the first merge are all undo needs.
+	if(!dub_saved) {
+		undo_push(dub_pattern, 0, p->length);
+		dub_saved = 1;
+	}
+
+	cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+	c = Get_sys_count();
+
+	for(i=0;i<PLAYHEADS;i++)
+		at[i] = dub_before(&ph[i], n);
+
+	tn = p->total_time;
+	i = p->length - 1;
+	j = n - 1;
+	o = p->length + n - 1;
+	ti = 0;
+	if(i >= 0 && tn > p->e[i].interval)
+		ti = tn - p->e[i].interval;
+
+	// o stays above i until the overdubs run out, so nothing is read after
+	// it has been overwritten
+	while(j >= 0) {
+		d = &dub[(dub_rd + j) & (DUB_EVENTS - 1)];
+		td = d->t;
+		if(td > tn)
+			td = tn;
+
+		if(i < 0 || td >= ti) {
+			p->e[o].shape = d->shape;
+			p->e[o].x = d->x;
+			p->e[o].y = d->y;
+			p->e[o].interval = tn - td;
+			tn = td;
+			j--;
+		}
+		else {
+			p->e[o] = p->e[i];
+			p->e[o].interval = tn - ti;
+			tn = ti;
+			i--;
+			if(i >= 0)
+				ti = ti > p->e[i].interval ? ti - p->e[i].interval : 0;
+		}
+		o--;
+	}
+	if(i >= 0)
+		p->e[i].interval = tn - ti;
+
+	p->length += n;
+	dub_rd = wr;
+	seek_valid = 0;
+
+	for(i=0;i<PLAYHEADS;i++)
+		dub_refit(&ph[i], at[i]);
+
+	c = Get_sys_count() - c;
+	if(c > dub_cycles)
+		dub_cycles = c;
+
+	cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+}
+
+// pattern switching: a switch is queued and lands on the next loop point, or
+// on the next 1/sw_div of the loop. the loop point case is taken by ph_event
+// as it wraps, so the new pattern starts on the tick the old loop would have
+// restarted on. a chain is the same thing with the next pattern taken from
+// es.chain each time the repeats run out.
+
+static void ph_take(playhead_t *h, u8 pattern) {
+	if(pattern != dub_pattern && r_status == rDub)
+		r_status = rOff;
+
+	sw_pending = 0;
+	h->pattern = p_select = pattern;
+	h->rem = 0;
+}
+
+// returns 1 if playhead 0 keeps going whatever the pattern's loop setting
+static u8 ph_wrap_next(playhead_t *h) {
+	if(sw_pending) {
+		ph_take(h, sw_pattern);
+		return 1;
+	}
+
+	if(!chain_on)
+		return 0;
+
+	if(chain_left > 1) {
+		chain_left--;
+		return 1;
+	}
+
+	chain_pos++;
+	if(chain_pos == CHAIN_STEPS || !es.chain[chain_pos].repeats)
+		chain_pos = 0;
+	chain_left = es.chain[chain_pos].repeats;
+	ph_take(h, es.chain[chain_pos].pattern);
+
+	return 1;
+}
+
+// mid-loop switch. the boundary's tick is worked out from the next event
+// every time, so it follows a rate change made while waiting.
+static void ph_switch_due(void) {
+	playhead_t *h = &ph[0];
+	u16 rate = ph_rate(h);
+	u32 due;
+
+	if(!sw_at || !h->playing || h->clock == phClockII)
+		return;
+
+	if(sw_at >= h->offset)
+		due = h->due + ((u32)(sw_at - h->offset) << 8) / rate;
+	else
+		due = h->due - ((u32)(h->offset - sw_at) << 8) / rate;
+
+	if((s32)(ph_tick - due) < 0)
+		return;
+
+	ph_take(h, sw_pattern);
+	h->pos = 0;
+	h->offset = 0;
+	h->due = due;
+	ph_schedule(h);
+}
+
+static void ph_event(u8 n) {
+	playhead_t *h = &ph[n];
+	pattern_t *p = &es.p[h->pattern];
+	pattern_event_t *e;
+	s8 x, y;
+	u16 rate;
+	u32 t;
+
+	// ii clocked playhead 0 takes a mid-loop switch on the first event past it
+	if(!n && sw_pending && sw_at && h->clock == phClockII && h->offset >= sw_at) {
+		ph_take(h, sw_pattern);
+		h->sbase -= h->offset << 8;
+		h->offset = 0;
+		h->pos = 0;
+		p = &es.p[h->pattern];
+	}
+
+	if(h->pos >= p->length) {
+		if(!n && h->pattern == dub_pattern && dub_wr != dub_rd)
+			dub_queued = 1;
+
+		// playhead 0 may carry on into a queued pattern or the next chain step
+		if(n || !ph_wrap_next(h)) {
+			if(!p->length || !ph_loops(h)) {
+				// print_dbg("\r\nPATTERN DONE");
+				h->playing = 0;
+				return;
+			}
+		}
+
+		// print_dbg("\r\nLOOP");
+		// an all-zero pattern still has to let time pass
+		if(!h->offset)
+			h->due++;
+		h->sbase -= h->offset << 8;
+		h->offset = 0;
+		h->pos = 0;
+
+		p = &es.p[h->pattern];
+		if(!p->length) {
+			h->playing = 0;
+			return;
+		}
+	}
+
+	e = &p->e[h->pos];
+
+	x = e->x + p->x + h->x;
+	y = e->y + p->y + h->y;
+
+	if(x<0) x = 0;
+	else if(x>15) x=15;
+	if(y<0) y = 0;
+	else if(y>7) y=7;
+
+	pattern_shape(e->shape, (u8)x, (u8)y, ph_outputs(n));
+
+	h->offset += e->interval;
+	h->pos++;
+
+	// the next due time is only ever worked out here (and by the step code
+	// for the ii clock, from the same position)
+	if(h->clock == phClockII) {
+		ph_step_due(h);
+		return;
+	}
+
+	rate = ph_rate(h);
+	t = ((u32)e->interval << 8) + h->rem;
+	h->due += t / rate;
+	h->rem = t % rate;
+}
+
+// ii clock: each pulse (or every div-th) starts a group of mul steps spread
+// over the measured pulse period and shifted by the pattern's groove. a step
+// plays the pattern's mean interval worth of its recorded time, stretched to
+// the step's length, so events land where they were recorded relative to the
+// pulse and an evenly played pattern still gets one event a step. the pulse
+// only sets up the group and the steps are due times like any other, so the
+// cost per pulse doesn't depend on the ratio.
+
+// pattern time a step covers, in 1/256 ticks. 0 plays one event a step.
+static s32 ph_stride(playhead_t *h) {
+	pattern_t *p = &es.p[h->pattern];
+
+	return p->length ? ((s32)p->total_time << 8) / p->length : 0;
+}
+
+// how far the groove has moved step k (counted over the groove's four steps)
+static s32 groove_off(const u8 *g, u8 k) {
+	s32 off = 0;
+	u8 j;
+
+	for(j=0;j<(k & 3);j++)
+		off += g[j] - 64;
+
+	return off;
+}
+
+// next event or, if it's past this step, the step's end. an early pulse can
+// leave events behind the step (x < 0), which play straight away.
+static void ph_step_due(playhead_t *h) {
+	const u8 *g = GROOVE[es.p[h->pattern].groove];
+	u8 a = h->gstep - h->sub;
+	s32 stride = ph_stride(h), x, t, len;
+
+	if(!h->len8 || !stride || h->sub >= h->subs)
+		return;
+
+	t = h->sub * h->len8 + (s32)h->len8 * (groove_off(g, h->gstep) - groove_off(g, a)) / 64;
+	len = (s32)h->len8 * g[h->gstep & 3] / 64;
+
+	x = (h->offset << 8) - h->sbase;
+	if(x < 0)
+		x = 0;
+	else if(x > stride)
+		x = stride;
+
+	h->due = h->gstart + ((t + (s64)len * x / stride) >> 8);
+}
+
+static void ph_steps(u8 n) {
+	playhead_t *h = &ph[n];
+	s32 stride;
+
+	while(h->playing && h->sub < h->subs && (s32)(ph_tick - h->due) >= 0) {
+		stride = ph_stride(h);
+
+		// until the period is known it's one event a pulse
+		if(!h->len8 || !stride) {
+			ph_event(n);
+			h->sbase = h->offset << 8;
+		}
+		else if((s32)(h->offset << 8) - h->sbase < stride) {
+			ph_event(n);
+			continue;
+		}
+		else
+			h->sbase += stride;
+
+		h->gstep++;
+		h->sub++;
+		ph_step_due(h);
+	}
+
+	if(h->playing && h->sub < h->subs)
+		ph_schedule(h);
+}
+
+static void ph_run(void) {
+	u8 i;
+	playhead_t *h;
+
+	ph_next = ph_tick + PH_NEVER;
+
+	for(i=0;i<PLAYHEADS;i++) {
+		h = &ph[i];
+		if(!h->playing)
+			continue;
+
+		if(h->clock == phClockII) {
+			ph_steps(i);
+			continue;
+		}
+
+		// zero intervals put several events on one tick
+		while(h->playing && (s32)(ph_tick - h->due) >= 0) {
+			ph_event(i);
+			monomeFrameDirty++;
+		}
+
+		if(h->playing)
+			ph_schedule(h);
+	}
+}
+
+// ES_CLOCK
+static void ph_pulse(void) {
+	playhead_t *h;
+	pattern_t *p;
+	u32 per = clk_ii.lock == 2 ? clk_ii.period : 0;
+	u8 i, k;
+
+	for(i=0;i<PLAYHEADS;i++) {
+		h = &ph[i];
+		if(!h->playing || h->clock != phClockII)
+			continue;
+		p = &es.p[h->pattern];
+
+		k = h->divc;
+		if(++h->divc >= p->div)
+			h->divc = 0;
+		if(k)
+			continue;
+
+		// a new group of steps. the pattern time of any steps the last
+		// group didn't get to is skipped so the pulse stays on the beat.
+		if(h->len8)
+			h->sbase += (s32)(h->subs - h->sub) * ph_stride(h);
+		h->gstart = ph_tick;
+		h->due = ph_tick;
+		h->sub = 0;
+		h->subs = per ? p->mul : 1;
+		h->len8 = per ? ((u64)per * p->div << 8) /
+			((u64)p->mul * clockTimer.ticks * (FMCK_HZ / 1000)) : 0;
+		ph_step_due(h);
+
+		ph_steps(i);
+	}
+}
+
+// worked back from the next event, which stays right through rate changes
+static u16 ph_elapsed(u8 n) {
+	s32 left = ph[n].due - ph_tick;
+	u32 back;
+
+	if(ph[n].clock == phClockII || left <= 0)
+		return ph[n].offset;
+
+	back = ((u32)left * ph_rate(&ph[n])) >> 8;
+	return back < ph[n].offset ? ph[n].offset - back : 0;
+}
+
+// seeking: a prefix sum of the intervals gives every event's time in the loop,
+// so the event at any time is a binary search away. the index is kept for one
+// pattern at a time and dropped whenever a pattern is edited.
+
+static void seek_index(u8 n) {
+	u8 i;
+
+	if(seek_valid && seek_pattern == n)
+		return;
+
+	seek_off[0] = 0;
+	for(i=0;i<es.p[n].length;i++)
+		seek_off[i+1] = seek_off[i] + es.p[n].e[i].interval;
+
+	seek_pattern = n;
+	seek_valid = 1;
+}
+
+// first event at or after t
+static u8 seek_find(u8 n, u16 t) {
+	u8 lo = 0, hi = es.p[n].length, mid;
+
+	seek_index(n);
+
+	while(lo < hi) {
+		mid = (lo + hi) >> 1;
+		if(seek_off[mid] < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+// put a playhead at pattern tick t, starting it if stopped. the next event
+// keeps whatever part of its interval is left, so a seek to the time a
+// sequencer says it is lands in phase with it.
+void ph_seek(u8 n, u16 t) {
+	playhead_t *h = &ph[n];
+	pattern_t *p;
+	u32 now = ph_tick + 1;
+
+	if(!n && !h->playing)
+		h->pattern = p_select;
+
+	p = &es.p[h->pattern];
+	if(!p->length || !p->total_time)
+		return;
+
+	t %= p->total_time;
+
+	h->pos = seek_find(h->pattern, t);
+	h->offset = seek_off[h->pos];
+	h->rem = 0;
+	h->due = now + ((u32)(h->offset - t) << 8) / ph_rate(h);
+	h->playing = 1;
 
-// handler protos
-static void handler_None(s32 data) { ;; }
-static void handler_KeyTimer(s32 data);
-static void handler_Front(s32 data);
-static void handler_ClockNormal(s32 data);
+	// an ii clocked playhead carries on from t at the next pulse
+	if(h->clock == phClockII) {
+		h->sbase = (s32)t << 8;
+		h->sub = h->subs = 0;
+	}
 
-u8 flash_is_fresh(void);
-void flash_unfresh(void);
-void flash_write(void);
-void flash_read(void);
+	ph_schedule(h);
+}
 
-static void shape(u8 s, u8 x, u8 y);
-static void pattern_shape(u8 s, u8 x, u8 y);
+void ph_play(u8 n, u8 pattern) {
+	playhead_t *h = &ph[n];
+
+	if(!n) {
+		h->playing = 0;
+		sw_pending = 0;
+		// a shape can start playback from the clock timer
+		if(dub_wr != dub_rd)
+			dub_queued = 1;
+		if(pattern != dub_pattern && r_status == rDub)
+			r_status = rOff;
+	}
 
-void rec_arm(void);
-void rec_start(void);
-void rec_stop(void);
-void rec(u8 shape, u8 x, u8 y);
-void play(void);
-void stop(void);
+	h->pattern = pattern;
+	h->pos = 0;
+	h->offset = 0;
+	h->rem = 0;
+	h->due = ph_tick + 1;
+	h->xbase = ext_clk()->n + 1;
+	h->divc = 0;
+	h->sub = h->subs = 0;
+	h->gstep = 0;
+	h->sbase = 0;
+	h->playing = 1;
+
+	ph_schedule(h);
+}
 
-void pattern_linearize(void);
-void pattern_time_half(void);
-void pattern_time_double(void);
+void ph_stop(u8 n) {
+	ph[n].playing = 0;
+	if(!n)
+		sw_pending = chain_on = 0;
+}
 
-void reset_hys(void);
+void ph_clock(u8 n, u8 clock) {
+	// pick up from the next tick without losing the position in the loop
+	if(clock == phClockExt && ph[n].clock != phClockExt) {
+		ph[n].xrate = es.p[ph[n].pattern].rate;
+		ph[n].xbase = ext_clk()->n + 1;
+	}
+	ph[n].clock = clock;
+	ph[n].divc = 0;
+	ph[n].sub = ph[n].subs = 0;
+	ph[n].gstep = 0;
+	ph[n].sbase = ph[n].offset << 8;
+	ph[n].due = ph_tick + 1;
+	ph_schedule(&ph[n]);
+}
 
+// set the rate of externally clocked playheads from the measured period, so
+// a loop lasts ext_ppl pulses (times the pattern's div / mul), then nudge it by
+// a quarter of the distance to where the pulse count says the loop should be.
+// the nudge is never more than a quarter of a pulse, so there are no jumps
+// and no skipped events.
+static void ext_follow(void) {
+	clk_est_t *k = ext_clk();
+	playhead_t *h;
+	pattern_t *p;
+	u64 rate, tick = (u64)clockTimer.ticks * (FMCK_HZ / 1000);
+	s64 e, seg;
+	s32 left;
+	u32 since = Get_sys_count() - k->stamp;
+	u16 len;
+	u8 i;
 
-static void es_process_ii(uint8_t *data, uint8_t l);
-static void es_midi_process_ii(uint8_t *data, uint8_t l);
+	if(k->lock < 2 || !k->period)
+		return;
 
+	for(i=0;i<PLAYHEADS;i++) {
+		h = &ph[i];
+		p = &es.p[h->pattern];
+		if(!h->playing || h->clock != phClockExt || !p->total_time)
+			continue;
+
+		// loop length in pulses, scaled by mul so it stays whole
+		len = ext_ppl * p->div;
+
+		rate = (((u64)p->total_time * p->mul * tick << 8) + ((u64)len * k->period >> 1)) /
+			((u64)len * k->period);
+
+		// positions in 1/256 pattern ticks: where the pulse count puts the
+		// loop, moved on by the time since the pulse, against where the
+		// playhead is counting its remainder
+		seg = ((s64)p->total_time * p->mul << 8) / len;
+		if(seg) {
+			e = ((u64)((u16)(k->n - h->xbase) * p->mul % len) * p->total_time << 8) / len;
+			e += since * rate / tick;
+			left = h->due - ph_tick;
+			if(left < 0) left = 0;
+			e -= ((s64)h->offset << 8) - ((s64)left * h->xrate + h->rem);
+			e %= (s64)p->total_time << 8;
+			if(e > (s64)p->total_time << 7)
+				e -= (s64)p->total_time << 8;
+			else if(e < -((s64)p->total_time << 7))
+				e += (s64)p->total_time << 8;
+			if(e > seg) e = seg;
+			else if(e < -seg) e = -seg;
+			rate = rate * (4 * seg + e) / (4 * seg);
+		}
 
-void reset_hys() {
-	u8 i1;
+		if(rate < RATE_MIN) rate = RATE_MIN;
+		else if(rate > RATE_MAX) rate = RATE_MAX;
 
-	for(i1=0;i1<3;i1++) {
-		ain[i1].hys = 0;
-		ain[i1].latch = adc_last[i1] = adc[i1];
+		ph_rescale(h, h->xrate, rate);
+		h->xrate = rate;
 	}
+
+	ph_next = ph_tick + 1;
 }
 
+// O(1) per pattern and the recorded intervals are never touched. playheads
+// already waiting on this pattern have the rest of their wait rescaled so a
+// pot sweep is heard straight away.
+//
+// the clock timer moves due and rem on from ph_event, so the timer is held
+// off while they're rescaled, unless the caller already has it masked.
+void pattern_rate(u8 n, u16 rate) {
+	u8 i, held;
+	u16 old;
 
+	if(rate < RATE_MIN) rate = RATE_MIN;
+	else if(rate > RATE_MAX) rate = RATE_MAX;
 
+	held = cpu_irq_level_is_enabled(APP_TC_IRQ_PRIORITY);
+	if(held)
+		cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
 
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-// application clock code
+	old = es.p[n].rate;
+	for(i=0;i<PLAYHEADS;i++)
+		if(ph[i].playing && ph[i].pattern == n && ph[i].clock == phClockInt)
+			ph_rescale(&ph[i], old, rate);
 
-void clock(u8 phase) {
-;;
-}
+	es.p[n].rate = rate;
 
+	// let the next tick recompute the earliest due playhead
+	ph_next = ph_tick + 1;
 
+	if(held)
+		cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+}
 
-////////////////////////////////////////////////////////////////////////////////
-// timers
+// move playhead 0 to another pattern on the next boundary. stopped, or with
+// switching unquantized, it happens straight away.
+void pattern_switch(u8 pattern) {
+	u16 total = es.p[ph[0].pattern].total_time;
+	u16 seg, t;
 
-static softTimer_t clockTimer = { .next = NULL, .prev = NULL };
-static softTimer_t keyTimer = { .next = NULL, .prev = NULL };
-static softTimer_t cvTimer = { .next = NULL, .prev = NULL };
-static softTimer_t adcTimer = { .next = NULL, .prev = NULL };
-static softTimer_t monomePollTimer = { .next = NULL, .prev = NULL };
-static softTimer_t monomeRefreshTimer  = { .next = NULL, .prev = NULL };
-static softTimer_t midiPollTimer = { .next = NULL, .prev = NULL };
+	chain_on = 0;
 
+	if(!ph[0].playing || !es.sw_div) {
+		stop();
+		p_select = pattern;
+		play();
+		return;
+	}
 
-static void aout_write(void) {
-	// cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+	sw_pending = 0;
+	sw_at = 0;
+	if(es.sw_div > 1 && total >= es.sw_div) {
+		seg = total / es.sw_div;
+		t = (ph_elapsed(0) / seg + 1) * seg;
+		if(t < total)
+			sw_at = t;
+	}
+	sw_pattern = pattern;
+	sw_pending = 1;
+}
 
-	spi_selectChip(SPI,DAC_SPI_NPCS);
-	spi_write(SPI,0x31);
-	spi_write(SPI,aout[2].now>>4);
-	spi_write(SPI,aout[2].now<<4);
-	spi_write(SPI,0x31);
-	spi_write(SPI,aout[0].now>>4);
-	spi_write(SPI,aout[0].now<<4);
-	spi_unselectChip(SPI,DAC_SPI_NPCS);
+void chain_start() {
+	if(!es.chain[0].repeats)
+		return;
 
-	spi_selectChip(SPI,DAC_SPI_NPCS);
-	spi_write(SPI,0x38);
-	spi_write(SPI,aout[3].now>>4);
-	spi_write(SPI,aout[3].now<<4);
-	spi_write(SPI,0x38);
-	spi_write(SPI,aout[1].now>>4);
-	spi_write(SPI,aout[1].now<<4);
-	spi_unselectChip(SPI,DAC_SPI_NPCS);
+	stop();
+	p_select = es.chain[0].pattern;
+	play();
 
-	// cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+	chain_pos = 0;
+	chain_left = es.chain[0].repeats;
+	chain_on = 1;
 }
 
-static void cvTimer_callback(void* o) {
+// anything loaded from flash or over sysex goes through here
+static void pattern_check(pattern_t *p) {
+	if(p->rate < RATE_MIN || p->rate > RATE_MAX)
+		p->rate = RATE_UNITY;
+	if(!p->mul || p->mul > RATIO_MAX)
+		p->mul = 1;
+	if(!p->div || p->div > RATIO_MAX)
+		p->div = 1;
+	if(p->groove >= GROOVES)
+		p->groove = 0;
+}
+
+static void ph_init(void) {
 	u8 i;
 
-	if(slew_active) {
-		for(i=0;i<4;i++) {
-			if(aout[i].step) {
-				aout[i].step--;
+	for(i=0;i<PLAYHEADS;i++) {
+		ph[i].playing = 0;
+		ph[i].loop = phLoopPattern;
+		ph[i].clock = phClockInt;
+		ph[i].out = OUT_ALL;
+		ph[i].x = ph[i].y = 0;
+	}
 
-				if(aout[i].step == 0) {
-					aout[i].now = aout[i].target;
-				}
-				else {
-					aout[i].a += aout[i].delta;
-					aout[i].now = aout[i].a >> 16;
-				}
+	ph_arb = arbLatest;
+	ph_next = ph_tick + PH_NEVER;
+	ext_ppl = EXT_PPL;
+}
 
-				monomeFrameDirty++;
-			}
-		}
-		aout_write();
-	}
+// what ES_GET reads, refreshed once a tick so the ii interrupt only copies
+static void ii_snapshot(void) {
+	playhead_t *h = &ph[0];
+	u8 n = h->playing ? h->pattern : p_select;
+	pattern_t *p = &es.p[n];
+
+	ii_snap[snPlaying] = h->playing;
+	ii_snap[snPattern] = n;
+	ii_snap[snPos] = h->pos;
+	ii_snap[snLength] = p->length;
+	ii_snap[snTotal] = p->total_time;
+	ii_snap[snElapsed] = h->playing ? ph_elapsed(0) : 0;
+	ii_snap[snRate] = h->playing ? ph_rate(h) : p->rate;
+	ii_snap[snPreset] = preset_select;
+	ii_snap[snCv0] = aout[0].now;
+	ii_snap[snCv1] = aout[1].now;
+	ii_snap[snCv2] = aout[2].now;
+	ii_snap[snCv3] = aout[3].now;
+}
+
+// the pattern magics edit patterns and undo, so they run from the main loop
+static void magic(u8 m) {
+	if(m==10)
+		pattern_transform(p_select, es.xf[0]);
+	else if(m==11)
+		pattern_time_half();
+	else if(m==12)
+		pattern_time_double();
+	else if(m==13)
+		pattern_switch((p_select + 1) & 15);
+	else if(m==14)
+		pattern_switch((p_select + 15) & 15);
+	monomeFrameDirty++;
 }
 
 static void clockTimer_callback(void* o) {
@@ -471,26 +1986,8 @@ static void clockTimer_callback(void* o) {
 				// MAGICS
 				if(i1==9)
 					all_edit = 1;
-				else if(i1==10)
-					pattern_linearize();
-				else if(i1==11)
-					pattern_time_half();
-				else if(i1==12)
-					pattern_time_double();
-				else if(i1==13) {
-					if(p_select<15)
-						p_select++;
-					else
-						p_select = 0;
-					play();
-				}
-				else if(i1==14) {
-					if(p_select > 0)
-						p_select--;
-					else
-						p_select = 15;
-					play();
-				}
+				else
+					magic_queued = i1;
 			}
 			else {
 				if(r_status != rOff)
@@ -503,73 +2000,40 @@ static void clockTimer_callback(void* o) {
 		shape_counter--;
 	}
 
-	if(edge_counter) {
-		if(edge_counter == 1) {
-			gpio_clr_gpio_pin(B00);
-			edge_state = 0;
-			monomeFrameDirty++;
-			// print_dbg("\r\ntrig done.");
-		}
-
-		edge_counter--;
-	}
-
 	if(r_status == rRec) {
 		rec_timer++;
 	}
 
-	if(clock_mode == 0) {
-		if(p_playing) {
-			if(p_timer == 0) {
-				if(p_play_pos >= es.p[p_select].length && !es.p[p_select].loop) {
-					// print_dbg("\r\nPATTERN DONE");
-					p_playing = 0;
-				}
-				else {
-					if(p_play_pos >= es.p[p_select].length && es.p[p_select].loop) {
-						// print_dbg("\r\nLOOP");
-						p_play_pos = 0;
-						p_timer_total = 0;
-					}
-
-					u8 i = p_play_pos;
-					p_timer = es.p[p_select].e[i].interval;
-
-					s8 x = es.p[p_select].e[i].x + es.p[p_select].x;
-					s8 y = es.p[p_select].e[i].y + es.p[p_select].y;
-
-					if(x<0) x = 0;
-					else if(x>15) x=15;
-					if(y<0) y = 0;
-					else if(y>7) y=7;
+	ph_tick++;
 
+	// while ii frames run the playheads, ii pulses and the snapshot wait, so
+	// each frame lands between two of their ticks. due times are absolute and
+	// catch up on the next tick.
+	if(!ph_hold) {
+		if(ext_clk()->fresh) {
+			ext_clk()->fresh = 0;
+			ext_follow();
+		}
 
-					// print_dbg("\r\n");
-					// print_dbg_ulong(i);
-					// print_dbg(" : ");
-					// print_dbg_ulong(es.p[p_select].e[i].shape);
-					// print_dbg(" @ (");
-					// print_dbg_ulong(es.p[p_select].e[i].x);
-					// print_dbg(", ");
-					// print_dbg_ulong(es.p[p_select].e[i].y);
-					// print_dbg(")   NEXT: ");
-					// print_dbg_ulong(es.p[p_select].e[i].interval);
-
-					pattern_shape(es.p[p_select].e[i].shape, (u8)x, (u8)y);
-
-					p_play_pos++;
-				}
-			}
-			else p_timer--;
-
-			p_timer_total++;
+		if(sw_pending)
+			ph_switch_due();
 
+		while(ii_pulse_rd != ii_pulse_wr) {
+			ii_pulse_rd++;
+			ph_pulse();
 			monomeFrameDirty++;
 		}
+
+		if((s32)(ph_tick - ph_next) >= 0)
+			ph_run();
+
+		ii_snapshot();
 	}
 
+	if(ph[0].playing)
+		monomeFrameDirty++;
 
-	if(r_status == rRec || all_edit || !VARI) {
+	if(r_status == rRec || r_status == rDub || all_edit || !VARI) {
 		blinker++;
 		if(blinker == 48)
 			blinker = 0;
@@ -582,6 +2046,9 @@ void rec_arm() {
 	stop();
 	// print_dbg("\r\narm");
 
+	// saved here rather than on the first shape, which is found in the timer
+	undo_push(p_select, 0, es.p[p_select].length);
+
 	r_status = rArm;
 }
 
@@ -596,16 +2063,18 @@ void rec_stop() {
 
 	// print_dbg("\r\nstopped rec");
 
-	// set final length
-	if(rec_timer) es.p[p_select].e[rec_position-1].interval = rec_timer-1;
-	else es.p[p_select].e[rec_position-1].interval = 1;
+	// set final length, intervals are exact tick deltas so the loop is as
+	// long as the take
+	es.p[p_select].e[rec_position-1].interval = rec_timer;
 
 	es.p[p_select].length = rec_position;
+	seek_valid = 0;
 
 	es.p[p_select].total_time = 0;
 
 	es.p[p_select].x = 0;
 	es.p[p_select].y = 0;
+	es.p[p_select].rate = RATE_UNITY;
 
 	for(i=0;i<rec_position;i++) {
 		es.p[p_select].total_time += es.p[p_select].e[i].interval;
@@ -628,8 +2097,46 @@ void rec_stop() {
 	r_status = rOff;
 }
 
+void dub_start() {
+	pattern_t *p = &es.p[ph[0].pattern];
+
+	if(!ph[0].playing || !p->length || !p->total_time)
+		return;
+
+	dub_merge();
+	dub_pattern = ph[0].pattern;
+	dub_saved = 0;
+	r_status = rDub;
+}
+
+static void dub_add(u8 shape, u8 x, u8 y) {
+	pattern_t *p = &es.p[dub_pattern];
+	dub_event_t *d;
+	s8 dx, dy;
+
+	if(!ph[0].playing || ph[0].pattern != dub_pattern)
+		return;
+	if(((dub_wr - dub_rd) & (DUB_EVENTS - 1)) == DUB_EVENTS - 1)
+		return;
+
+	// undo the transpose so the overdub plays back where it was played
+	dx = x - p->x - ph[0].x;
+	dy = y - p->y - ph[0].y;
+
+	d = &dub[dub_wr];
+	d->shape = shape;
+	d->x = dx < 0 ? 0 : dx > 15 ? 15 : dx;
+	d->y = dy < 0 ? 0 : dy > 7 ? 7 : dy;
+	d->t = ph_elapsed(0);
+	dub_wr = (dub_wr + 1) & (DUB_EVENTS - 1);
+}
+
 void rec(u8 shape, u8 x, u8 y) {
-	if(r_status == rArm) {
+	if(r_status == rDub) {
+		dub_add(shape, x, y);
+	}
+	else if(r_status == rArm) {
+		seek_valid = 0;
  		es.p[p_select].e[0].shape = shape;
 		es.p[p_select].e[0].x = x;
 		es.p[p_select].e[0].y = y;
@@ -640,8 +2147,7 @@ void rec(u8 shape, u8 x, u8 y) {
 		es.p[p_select].e[rec_position].shape = shape;
 		es.p[p_select].e[rec_position].x = x;
 		es.p[p_select].e[rec_position].y = y;
-		if(rec_timer) es.p[p_select].e[rec_position-1].interval = rec_timer-1;
-		else es.p[p_select].e[rec_position-1].interval = 1;
+		es.p[p_select].e[rec_position-1].interval = rec_timer;
 
 		rec_position++;
 		rec_timer = 0;
@@ -651,83 +2157,349 @@ void rec(u8 shape, u8 x, u8 y) {
 }
 
 void play() {
-	p_timer = 0;
-	p_play_pos = 0;
-	p_timer_total = 0;
-	p_playing = 1;
+	ph_play(0, p_select);
 
 	// print_dbg("\r\nPLAY");
 }
 
 void stop() {
-	p_playing = 0;
+	ph_stop(0);
+	dub_merge();
+	if(r_status == rDub)
+		r_status = rOff;
 	if(es.edge == eStandard) {
-		gpio_clr_gpio_pin(B00);
-		edge_state = 0;
+		gate_off();
 		// legato = 0;
 	}
 }
 
 
 void pattern_linearize() {
-	u8 i, note, rest;
+	static const xform_t linear[] = { { xfLinear, 0 }, { xfEnd, 0 } };
 
-	note = es.p[p_select].e[0].interval;
-	rest = es.p[p_select].e[1].interval;
+	pattern_transform(p_select, linear);
+}
+
+static u32 xf_random(void) {
+	static u32 r = 0x2545f491;
+
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	return r;
+}
+
+static u8 xf_reorders(u8 op) {
+	return op == xfReverse || op == xfRotate;
+}
+
+// one pass of a transform chain: any reordering ops, then ops that don't
+// reorder.
+//
+// reverse and rotate only change the order events are read in, so a run of
+// them folds into one index map, src = dir * i + base (mod length). every
+// other op works on an event's absolute time within the loop and intervals
+// are rebuilt from consecutive times as events are written. that lets
+// quantize, humanize and stretch move events and thin drop them without
+// revisiting anything, and total_time is set once at the end.
+static void xf_pass(pattern_t *p, const xform_t *xf, u8 ops) {
+	static pattern_event_t buf[EVENTS_PER_PATTERN];
+
+	pattern_event_t *e;
+	u32 total[XF_OPS + 1], prev[XF_OPS], t, src_t, last, first;
+	u16 note, rest;
+	u8 count[XF_OPS], len = p->length, i, f, k, out, drop, q;
+	s16 base = 0, x, y, x0, y0, r;
+	s8 dir = 1;
+
+	// fold the reordering ops
+	for(f=0;f<ops;f++) {
+		if(xf[f].op == xfReverse) {
+			base += dir * (len - 1);
+			dir = -dir;
+		}
+		else if(xf[f].op == xfRotate)
+			base += dir * (xf[f].arg % len);
+
+		base %= len;
+		if(base < 0) base += len;
+	}
+
+	// read with the reordering applied. walking backwards an event's gap is
+	// the one that used to lead into it.
+	#define XF_SRC(i) ((base + dir * (s16)(i) + 2 * len) % len)
+	#define XF_GAP(k) (p->e[dir > 0 ? (k) : ((k) + len - 1) % len].interval)
+
+	x0 = p->e[XF_SRC(0)].x;
+	y0 = p->e[XF_SRC(0)].y;
+	note = XF_GAP(XF_SRC(0));
+	rest = len > 1 ? XF_GAP(XF_SRC(1)) : note;
+
+	// loop length after each op
+	total[0] = p->total_time;
+	for(f=0;f<ops;f++) {
+		total[f+1] = total[f];
+		prev[f] = 0;
+		count[f] = 0;
+		q = xf[f].arg;
+
+		if(xf[f].op == xfQuantize && xf[f].arg > 0) {
+			t = ((total[f] + (q >> 1)) / q) * q;
+			total[f+1] = t ? t : q;
+		}
+		else if(xf[f].op == xfStretch && xf[f].arg > 0)
+			total[f+1] = (total[f] * q) / XF_STRETCH_UNITY;
+		else if(xf[f].op == xfLinear)
+			total[f+1] = (len >> 1) * (note + rest) + (len & 1) * note;
+	}
+
+	src_t = last = first = 0;
+	out = 0;
+
+	for(i=0;i<len;i++) {
+		k = XF_SRC(i);
+		e = &p->e[k];
+		t = src_t;
+		src_t += XF_GAP(k);
+		x = e->x;
+		y = e->y;
+		drop = 0;
+
+		for(f=0;f<ops && !drop;f++) {
+			q = xf[f].arg;
+
+			switch(xf[f].op) {
+				case xfQuantize:
+					if(xf[f].arg > 0)
+						t = ((t + (q >> 1)) / q) * q;
+					break;
+				case xfTranspose:
+					x += xf[f].arg % 5;
+					y -= xf[f].arg / 5;
+					break;
+				case xfInvert:
+					x = 2 * x0 - x;
+					y = 2 * y0 - y;
+					break;
+				case xfStretch:
+					if(xf[f].arg > 0)
+						t = (t * q) / XF_STRETCH_UNITY;
+					break;
+				case xfHumanize:
+					if(xf[f].arg > 0) {
+						r = (s16)(xf_random() % (2 * q + 1)) - q;
+						if(r < 0 && (u32)-r > t) t = 0;
+						else t += r;
+					}
+					break;
+				case xfThin:
+					drop = xf[f].arg > 1 && (count[f] % q);
+					count[f]++;
+					break;
+				case xfLinear:
+					t = (i >> 1) * (note + rest) + (i & 1) * note;
+					break;
+				default:
+					break;
+			}
 
+			// keep events in order and inside the loop
+			if(t > total[f+1]) t = total[f+1];
+			if(t < prev[f]) t = prev[f];
+			prev[f] = t;
+		}
+
+		if(drop)
+			continue;
 
-	for(i=0;i<es.p[p_select].length+1;i++)
-		if(i%2)
-			es.p[p_select].e[i].interval = rest;
+		if(x < 0) x = 0;
+		else if(x > 15) x = 15;
+		if(y < 0) y = 0;
+		else if(y > 7) y = 7;
+
+		if(out) {
+			t -= last;
+			buf[out-1].interval = t > 0xffff ? 0xffff : t;
+			t += last;
+		}
 		else
-			es.p[p_select].e[i].interval = note;
+			first = t;
 
-	es.p[p_select].total_time = 0;
+		buf[out].shape = e->shape;
+		buf[out].x = x;
+		buf[out].y = y;
+		last = t;
+		out++;
+	}
 
-	for(i=0;i<es.p[p_select].length;i++) {
-		es.p[p_select].total_time += es.p[p_select].e[i].interval;
+	#undef XF_SRC
+	#undef XF_GAP
 
-		// print_dbg("\r\n");
-		// print_dbg_ulong(i);
-		// print_dbg(" : ");
-		// print_dbg_ulong(es.p[p_select].e[i].shape);
-		// print_dbg(" @ (");
-		// print_dbg_ulong(es.p[p_select].e[i].x);
-		// print_dbg(", ");
-		// print_dbg_ulong(es.p[p_select].e[i].y);
-		// print_dbg(") + ");
-		// print_dbg_ulong(es.p[p_select].e[i].interval);
+	// whatever led into the first event moves to the end of the loop
+	t = total[ops] - last + first;
+	buf[out-1].interval = t > 0xffff ? 0xffff : t;
+
+	// playheads read the pattern from the timer
+	cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+	for(i=0;i<out;i++)
+		p->e[i] = buf[i];
+	p->length = out;
+	p->total_time = total[ops] > 0xffff ? 0xffff : total[ops];
+	cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+}
+
+// applies a chain of transforms in order. a reordering op after one that
+// isn't starts a new pass, so a chain costs one pass per such step and most
+// chains are a single pass. main loop only: the passes share one buffer.
+void pattern_transform(u8 n, const xform_t *xf) {
+	u8 i, j;
+
+	if(es.p[n].length == 0)
+		return;
+
+	undo_push(n, 0, es.p[n].length);
+
+	for(i=0;i<XF_OPS && xf[i].op != xfEnd;i=j) {
+		for(j=i;j<XF_OPS && xf[j].op != xfEnd && xf_reorders(xf[j].op);j++);
+		for(;j<XF_OPS && xf[j].op != xfEnd && !xf_reorders(xf[j].op);j++);
+		xf_pass(&es.p[n], &xf[i], j - i);
 	}
- }
+
+	seek_valid = 0;
+	ph_refit(n);
+}
 
 void pattern_time_half() {
-	u8 i;
+	undo_push(p_select, 0, 0);
+	pattern_rate(p_select, es.p[p_select].rate << 1);
+}
+
+void pattern_time_double() {
+	undo_push(p_select, 0, 0);
+	pattern_rate(p_select, es.p[p_select].rate >> 1);
+}
+
 
-	for(i=0;i<es.p[p_select].length;i++) {
-		es.p[p_select].e[i].interval = es.p[p_select].e[i].interval >> 1;
-		if(!es.p[p_select].e[i].interval) es.p[p_select].e[i].interval = 1;
+////////////////////////////////////////////////////////////////////////////////
+// undo
+//
+// each record holds a pattern's header and the range of events an edit is
+// about to overwrite. undo swaps the record with the pattern and redo swaps it
+// back, so one record serves both ways and a step costs only the events it
+// covers. records sit in a ring and their events in a second ring; when
+// either runs out the oldest records go.
+
+#define UNDO_REC(k) (&undo[(undo_first + (k)) % UNDO_DEPTH])
+
+void undo_clear() {
+	undo_first = undo_count = undo_pos = undo_used = 0;
+}
+
+void undo_push(u8 n, u8 start, u8 count) {
+	pattern_t *p = &es.p[n];
+	undo_t *r;
+	u8 i, at;
+
+	// a new edit forgets anything that could have been redone
+	while(undo_count > undo_pos) {
+		undo_count--;
+		undo_used -= UNDO_REC(undo_count)->count;
 	}
 
-	es.p[p_select].total_time = 0;
+	while(undo_count && (undo_count == UNDO_DEPTH || undo_used + count > UNDO_EVENTS)) {
+		undo_used -= undo[undo_first].count;
+		undo_first = (undo_first + 1) % UNDO_DEPTH;
+		undo_count--;
+		undo_pos--;
+	}
 
-	for(i=0;i<es.p[p_select].length;i++) {
-		es.p[p_select].total_time += es.p[p_select].e[i].interval;
+	if(undo_count) {
+		r = UNDO_REC(undo_count - 1);
+		at = (r->at + r->count) % UNDO_EVENTS;
 	}
+	else
+		at = 0;
+
+	r = UNDO_REC(undo_count);
+	r->pattern = n;
+	r->start = start;
+	r->count = count;
+	r->length = p->length;
+	r->total_time = p->total_time;
+	r->rate = p->rate;
+	r->x = p->x;
+	r->y = p->y;
+	r->at = at;
+
+	for(i=0;i<count;i++)
+		undo_ev[(at + i) % UNDO_EVENTS] = p->e[start + i];
+
+	undo_used += count;
+	undo_count++;
+	undo_pos = undo_count;
 }
 
-void pattern_time_double() {
+// main loop only, like all of undo. the timer is held off while the pattern
+// is half swapped.
+static void undo_swap(undo_t *r) {
+	pattern_t *p = &es.p[r->pattern];
+	pattern_event_t e, *u;
+	u16 t;
 	u8 i;
+	s8 x;
 
-	for(i=0;i<es.p[p_select].length;i++)
-			es.p[p_select].e[i].interval = es.p[p_select].e[i].interval << 1;
-
-	es.p[p_select].total_time = 0;
+	cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
 
-	for(i=0;i<es.p[p_select].length;i++) {
-		es.p[p_select].total_time += es.p[p_select].e[i].interval;
+	for(i=0;i<r->count;i++) {
+		u = &undo_ev[(r->at + i) % UNDO_EVENTS];
+		e = p->e[r->start + i];
+		p->e[r->start + i] = *u;
+		*u = e;
 	}
+
+	i = p->length; p->length = r->length; r->length = i;
+	t = p->total_time; p->total_time = r->total_time; r->total_time = t;
+	x = p->x; p->x = r->x; r->x = x;
+	x = p->y; p->y = r->y; r->y = x;
+	seek_valid = 0;
+
+	t = p->rate;
+	pattern_rate(r->pattern, r->rate);
+	r->rate = t;
+
+	ph_refit(r->pattern);
+	cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+}
+
+static void undo_ready(void) {
+	// finish any overdub so the pass is all in the pattern first
+	if(r_status == rDub)
+		r_status = rOff;
+	dub_merge();
+}
+
+void pattern_undo() {
+	if(r_status == rRec || !undo_pos)
+		return;
+
+	undo_ready();
+	undo_pos--;
+	undo_swap(UNDO_REC(undo_pos));
+	monomeFrameDirty++;
+}
+
+void pattern_redo() {
+	if(r_status == rRec || undo_pos == undo_count)
+		return;
+
+	undo_ready();
+	undo_swap(UNDO_REC(undo_pos));
+	undo_pos++;
+	monomeFrameDirty++;
 }
 
+#undef UNDO_REC
+
 
 
 
@@ -746,6 +2518,14 @@ static void adcTimer_callback(void* o) {
 	event_post(&e);
 }
 
+// poll the pots every ms. the timer is taken out and put back with the new
+// period, so only libavr32 knows what's inside a softTimer_t.
+static void adc_every(u8 ms) {
+	adc_ms = ms;
+	timer_remove(&adcTimer);
+	timer_add(&adcTimer, ms, &adcTimer_callback, NULL);
+}
+
 //midi polling callback
 static void midi_poll_timer_callback(void* obj) {
   // asynchronous, non-blocking read
@@ -827,7 +2607,8 @@ static void handler_MonomeConnect(s32 data) {
 	// turn on ADC polling, reset hysteresis
 	adc_convert(&adc);
 	reset_hys();
-	timer_add(&adcTimer,61,&adcTimer_callback, NULL);
+	adc_slow = 61;
+	adc_every(adc_slow);
 }
 
 static void handler_MonomePoll(s32 data) { monome_read_serial(); }
@@ -844,6 +2625,24 @@ static void handler_MonomeRefresh(s32 data) {
 static void handler_Front(s32 data) {
 	// print_dbg("\r\n //// FRONT HOLD");
 
+	// midi learn: hold front, move a controller, then play a note to pick the
+	// destination. saved with the preset on release.
+	if(midi_active) {
+		if(data == 0) {
+			cc_learn = 1;
+			cc_learn_num = MIDI_CC_LEARN_NONE;
+		}
+		else {
+			if(cc_learn == 2) {
+				static event_t e;
+				e.type = kEventSaveFlash;
+				event_post(&e);
+			}
+			cc_learn = 0;
+		}
+		return;
+	}
+
 	if(data == 0) {
 		front_timer = 15;
 		if(preset_mode) preset_mode = 0;
@@ -856,57 +2655,180 @@ static void handler_Front(s32 data) {
 	monomeFrameDirty++;
 }
 
+static u16 pot_rate(u16 v) {
+	// lower half 1/4x to 1x, upper half 1x to 4x
+	if(v < 2048)
+		return (RATE_UNITY >> 2) + ((v * 192) >> 11);
+	return RATE_UNITY + (((v - 2048) * 768) >> 11);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// pots
+
+static u16 median3(u16 a, u16 b, u16 c) {
+	if(a > b) { u16 t = a; a = b; b = t; }
+	if(b > c) b = c;
+	return a > b ? a : b;
+}
+
+// oversample, drop spikes with a median of three polls, then a one-pole that
+// follows quickly while a pot moves and smooths hard at rest. the poll rate
+// drops when every pot is idle.
+static void adc_poll(void) {
+	u16 s[3], x;
+	u8 i, j, moving;
+	s32 d;
+
+	s[0] = s[1] = s[2] = 0;
+	for(j=0;j<ADC_OVERSAMPLE;j++) {
+		adc_convert(&adc);
+		for(i=0;i<3;i++)
+			s[i] += adc[i];
+	}
+
+	moving = 0;
+	for(i=0;i<3;i++) {
+		if(!adc_primed) {
+			ain[i].f = (u32)s[i] << 4;
+			ain[i].m[0] = ain[i].m[1] = ain[i].rest = s[i];
+			ain[i].v = ain[i].latch = ain[i].out = s[i] >> 2;
+			continue;
+		}
+
+		x = median3(s[i], ain[i].m[0], ain[i].m[1]);
+		ain[i].m[1] = ain[i].m[0];
+		ain[i].m[0] = s[i];
+
+		// movement is counted from where the pot settled rather than poll to
+		// poll, so a turn too slow to clear it in one poll still adds up
+		if(abs((s32)x - ain[i].rest) > ADC_MOVE) {
+			ain[i].rest = x;
+			ain[i].idle = ADC_IDLE;
+		}
+		else if(ain[i].idle && !--ain[i].idle)
+			ain[i].rest = ain[i].f >> 4;
+
+		d = ((s32)x << 4) - (s32)ain[i].f;
+		ain[i].f += d >> (ain[i].idle ? ADC_K_MOVE : ADC_K_IDLE);
+		ain[i].v = (ain[i].f + 32) >> 6;
+		// a raw sample off the rest point may be a spike the median will
+		// drop, but a few fast polls find out sooner than one slow one
+		moving |= ain[i].idle || abs((s32)s[i] - ain[i].rest) > ADC_MOVE;
+	}
+	adc_primed = 1;
+
+	j = moving ? ADC_FAST : adc_slow;
+	if(adc_ms != j)
+		adc_every(j);
+}
+
+// engaged pot whose filtered value moved at least one step of its destination
+static u8 pot_changed(u8 i, u16 res) {
+	if(!ain[i].hys) {
+		if(abs(ain[i].v - ain[i].latch) > POT_HYSTERESIS)
+			ain[i].hys = 1;
+		else
+			return 0;
+	}
+
+	if(res < ADC_NOISE)
+		res = ADC_NOISE;
+	if(abs(ain[i].v - ain[i].out) < res)
+		return 0;
+
+	ain[i].out = ain[i].v;
+	return 1;
+}
+
+// where each pot goes in the current mode, and the step it's reported at
+typedef enum {
+	potNone,
+	potPort,
+	potCv,
+	potSlew,
+	potEdge,
+	potRate
+} ePotDest;
+
+static const u8 POT_RES[] = { ADC_NOISE, 16, ADC_NOISE, ADC_NOISE, 16, ADC_NOISE };
+
+static u8 pot_dest(u8 i) {
+	if(port_edit == 1)
+		return i == 0 ? potPort : potNone;
+	if(mode == mNormal)
+		return potCv;
+	if(mode == mSlew)
+		return potSlew;
+	if(i)
+		return potNone;
+	if(mode == mEdge)
+		return potEdge;
+	if(mode == mSelect || mode == mBank)
+		return potRate;
+	return potNone;
+}
+
 static void handler_PollADC(s32 data) {
-	u8 i,n;
+	u8 i, n, n1, changed;
+	u8 dest[3];
+	u16 *r;
 
-	adc_convert(&adc);
+	adc_poll();
 
+	changed = 0;
 	for(i=0;i<3;i++) {
-		if(ain[i].hys) {
-			if(port_edit == 1) {
-				if(i == 0) {
-					aout[3].slew = port_time = ((adc[i] + adc_last[i])>>1 >> 4);
-					// print_dbg("\r\nportamento: ");
-					// print_dbg_ulong(port_time);
-				}
-			}
-			else if(all_edit) {
-				if(mode == mNormal) {
-					for(n=0;n<8;n++)
-						es.cv[n][i] = aout[i].target = (adc[i] + adc_last[i])>>1;
-					aout[i].step = 5; // smooth out the input
-					aout[i].delta = ((aout[i].target - aout[i].now)<<16) / aout[i].step;
-					aout[i].a = aout[i].now<<16;
-				}
-				else if(mode == mSlew) {
-					for(n=0;n<8;n++)
-						es.slew[n][i] = aout[i].slew = (adc[i] + adc_last[i])>>1;
-				}
-			}
-			else if(mode == mNormal) {
-				es.cv[shape_on][i] = aout[i].target = (adc[i] + adc_last[i])>>1;
-				aout[i].step = 5; // smooth out the input
-				aout[i].delta = ((aout[i].target - aout[i].now)<<16) / aout[i].step;
-				aout[i].a = aout[i].now<<16;
-			}
-			else if(mode == mSlew)
-				es.slew[shape_on][i] = aout[i].slew = (adc[i] + adc_last[i])>>1;
-			else if(mode == mEdge && i == 0)
-				es.edge_fixed_time = ((adc[i] + adc_last[i])>>1 >> 4);
+		dest[i] = pot_dest(i);
+		if(pot_changed(i, POT_RES[dest[i]]) && dest[i] != potNone)
+			changed |= 1 << i;
+	}
 
+	if(!changed)
+		return;
 
-			monomeFrameDirty++;
+	// cv and slew share a destination for all pots, so the matrix is walked
+	// once row by row. step constants are left to the shape trigger.
+	if(dest[0] == potCv || dest[0] == potSlew) {
+		n = all_edit ? 0 : shape_on;
+		n1 = all_edit ? 8 : shape_on + 1;
+		for(;n<n1;n++) {
+			r = dest[0] == potCv ? es.cv[n] : es.slew[n];
+			if(changed & 1) r[0] = ain[0].v;
+			if(changed & 2) r[1] = ain[1].v;
+			if(changed & 4) r[2] = ain[2].v;
+
+			if(dest[0] == potSlew)
+				for(i=0;i<3;i++)
+					if(changed & (1 << i))
+						slew_touch(n, i);
 		}
-		else if(abs(((adc[i] + adc_last[i])>>1) - ain[i].latch) > POT_HYSTERESIS)
-			ain[i].hys = 1;
 
-		adc_last[i] = adc[i];
+		for(i=0;i<3;i++) {
+			if(!(changed & (1 << i)))
+				continue;
+			if(dest[0] == potCv) {
+				aout[i].target = ain[i].v;
+				slew_start(i, 5, curveLin); // smooth out the input
+			}
+			else
+				aout[i].slew = ain[i].v;
+		}
 	}
+	else if(dest[0] == potPort) {
+		aout[3].slew = port_time = (ain[0].v >> 4);
+		// print_dbg("\r\nportamento: ");
+		// print_dbg_ulong(port_time);
+	}
+	else if(dest[0] == potEdge)
+		es.edge_fixed_time = (ain[0].v >> 4);
+	else if(dest[0] == potRate)
+		pattern_rate(p_select, pot_rate(ain[0].v));
+
+	monomeFrameDirty++;
 
-	// print_dbg("\r\nadc:\t"); print_dbg_ulong((adc[0] + adc_last[0])>>1);
-	// print_dbg("\t"); print_dbg_ulong((adc[1] + adc_last[1])>>1);
-	// print_dbg("\t"); print_dbg_ulong((adc[2] + adc_last[2])>>1);
-	// print_dbg("\t"); print_dbg_ulong((adc[3] + adc_last[3])>>1);
+	// print_dbg("\r\nadc:\t"); print_dbg_ulong(ain[0].v);
+	// print_dbg("\t"); print_dbg_ulong(ain[1].v);
+	// print_dbg("\t"); print_dbg_ulong(ain[2].v);
+	// print_dbg("\t"); print_dbg_ulong(adc_ms);
 
 }
 
@@ -953,7 +2875,8 @@ static void handler_KeyTimer(s32 data) {
 
 static void handler_ClockNormal(s32 data) {
 	// print_dbg("\r\nclock norm int");
-	// clock_external = !gpio_get_pin_value(B09);
+	ext_jack = !gpio_get_pin_value(B09);
+	clk_jack.lock = 0;
 }
 
 
@@ -1072,13 +2995,17 @@ static void handler_MonomeGridKey(s32 data) {
 						}
 					}
 					else if(arm_key) {
-						play();
+						// hold rec + play: overdub if already playing
+						if(ph[0].playing)
+							dub_start();
+						else
+							play();
 						selected = 1;
 					}
 					else if(mode == mSelect) {
 						mode = mBank;
 					}
-					else if(p_playing) {
+					else if(ph[0].playing) {
 						stop();
 					}
 					else {
@@ -1090,6 +3017,7 @@ static void handler_MonomeGridKey(s32 data) {
 			else if(y==1) {
 
 				if(z && mode != mBank) {
+					reset_hys();
 					r_status = rOff;
 					mode = mSelect;
 					// print_dbg("\r\nmode: select");
@@ -1116,6 +3044,11 @@ static void handler_MonomeGridKey(s32 data) {
 						r_status = rOff;
 						selected = 1;
 					}
+					else if(r_status == rDub) {
+						// pending overdubs still merge at the loop point
+						r_status = rOff;
+						selected = 1;
+					}
 				}
 				else {
 					if(r_status == rOff && !selected) {
@@ -1228,13 +3161,26 @@ static void handler_MonomeGridKey(s32 data) {
 			// SELECT
 			else if(mode == mSelect || mode == mBank) {
 				if(x>1 && x < 6 && y > 1 && y < 6) {
-					stop();
-					p_select = (y-2)*4+(x-2);
 					if(mode == mBank)
-						play();
+						pattern_switch((y-2)*4+(x-2));
+					else {
+						stop();
+						p_select = (y-2)*4+(x-2);
+					}
 					// print_dbg("\r\nselected ");
 					// print_dbg_ulong(p_select);
 				}
+				// TRANSFORM CHAINS
+				else if(y == 2 && x > 6 && x < 7 + XF_SLOTS) {
+					pattern_transform(p_select, es.xf[x-7]);
+				}
+				// UNDO / REDO
+				else if(y == 5 && x == 7) {
+					pattern_undo();
+				}
+				else if(y == 5 && x == 8) {
+					pattern_redo();
+				}
 			}
 			// SHAPE DETECT
 			else if(!legato) {
@@ -1275,8 +3221,7 @@ static void handler_MonomeGridKey(s32 data) {
 				if(es.edge == eStandard) {
 					if(r_status != rOff)
 						rec(100,x,y);
-					gpio_clr_gpio_pin(B00);
-					edge_state = 0;
+					gate_off();
 				}
 
 				legato = 0;
@@ -1289,100 +3234,272 @@ static void handler_MonomeGridKey(s32 data) {
 
 
 
-static void shape(u8 s, u8 x, u8 y) {
-	u8 i;
+////////////////////////////////////////////////////////////////////////////////
+// tuning
+//
+// the preset's tuning is worked out into tune[] and key_cv[] when it's loaded
+// or edited, so playing a note is one load. the default (12 edo, every
+// degree, rows a fourth apart) gives the same cv as SEMI.
+
+static u8 tune_degrees(void) {
+	switch(es.tune.kind) {
+		case tunJust:
+		case tunPyth:
+			return 12;
+		case tunCustom:
+			return es.tune.degrees;
+		default:
+			return es.tune.edo;
+	}
+}
 
-	// print_dbg("\r\nfound shape: ");
-	// print_dbg_ulong(s);
+// the custom degrees in order, made by tune_resolve. es.tune.custom keeps the
+// order they were entered in, so ES_TUNE_SET's index is always the same
+// degree.
+static u16 tune_sorted[TUNE_DEGREES];
 
-	// PATTERN PLAY MODE
-	if(arp && r_status == rOff && s<4) {
-		es.p[p_select].x = x - es.p[p_select].e[0].x;
-		es.p[p_select].y = y - es.p[p_select].e[0].y;
+static void tune_sort(void) {
+	u16 t;
+	u8 i, j;
+
+	for(i=0;i<es.tune.degrees;i++) {
+		t = es.tune.custom[i];
+		for(j=i;j && tune_sorted[j-1] > t;j--)
+			tune_sorted[j] = tune_sorted[j-1];
+		tune_sorted[j] = t;
 	}
-	else if(s<5) {
-		// cv_pos = SCALES[0][x] + (7-y)*170;
-		// cv_pos = SEMI[x+(7-y)*5];
-		// print_dbg("\r\n x:");
-		// print_dbg_ulong(x);
-		aout[3].target = SEMI[(x+(7-y)*5) - 1];
-		// print_dbg("\r\n cv:");
-		// print_dbg_ulong(aout[3].target);
+}
 
-		// aout[3].target = TONE[x*scale[scale_x]+(7-y)*scale[scale_y]];
+// cv of degree n counted up from the bottom. notes above the dac's range
+// keep their value so a bend can bring them back into it.
+static u16 tune_cv(u16 n) {
+	const u16 *t;
+	u32 v;
+	u8 d = tune_degrees();
+
+	if(es.tune.kind == tunJust)
+		t = JUST;
+	else if(es.tune.kind == tunPyth)
+		t = PYTH;
+	else if(es.tune.kind == tunCustom)
+		t = tune_sorted;
+	else
+		t = NULL;
+
+	if(t)
+		v = ((u32)(n / d) * 4096 + t[n % d]) / 10;
+	else
+		v = ((u32)n * 4096) / (10 * d);
 
-		if(port_active) {
-			aout[3].step = (aout[3].slew >> 2) + 1;
-			aout[3].delta = ((aout[3].target - aout[3].now)<<16) / aout[3].step;
-			aout[3].a = aout[3].now<<16;
-		}
-		else {
-			aout[3].now = aout[3].target;
+	return v;
+}
+
+// next degree at or after n the quantizer may land on. a scale that leaves
+// none in an octave gets 0xffff.
+static u16 quant_note(u16 n, u8 d) {
+	u8 j;
+
+	for(j=0;j<d;j++,n++)
+		if(!es.qscale || n % d >= 32 || (es.qscale & ((u32)1 << (n % d))))
+			return n;
+	return 0xffff;
+}
+
+// nearest allowed note for the middle of each 8 code bin. notes are taken
+// from tune_cv up to the top of the dac rather than from tune[], which
+// stops at 128 degrees (under 2737 codes in 19 edo). they only go up, so
+// one pass walks both lists. a custom scale is in tune_sorted already.
+static void quant_resolve(void) {
+	u16 lo, hi, vlo, vhi, b, v;
+	u8 d;
+
+	d = tune_degrees();
+	lo = quant_note(0, d);
+	if(lo == 0xffff) {
+		for(b=0;b<512;b++)
+			qtab[b] = b << 3;
+		return;
+	}
+	hi = quant_note(lo + 1, d);
+	vlo = tune_cv(lo);
+	vhi = tune_cv(hi);
+
+	for(b=0;b<512;b++) {
+		v = (b << 3) + 4;
+		while(vhi <= v) {
+			lo = hi;
+			vlo = vhi;
+			hi = quant_note(hi + 1, d);
+			vhi = tune_cv(hi);
 		}
+
+		if(vhi <= 4095 && v > vlo && vhi - v < v - vlo)
+			qtab[b] = vhi;
+		else
+			qtab[b] = vlo;
 	}
 
-	if(!arp && r_status == rOff && !port_active) {
-		// cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+	aout_sent[0] = aout_sent[1] = aout_sent[2] = 0xffff;
+}
+
+static void tune_resolve(void) {
+	u8 used[TUNE_EDO_MAX];
+	u8 d, m, i, x, y;
+	u16 k;
+
+	tune_sort();
+
+	d = tune_degrees();
+	m = 0;
+	for(i=0;i<d;i++)
+		if(!es.tune.scale || i >= 32 || (es.tune.scale & ((u32)1 << i)))
+			used[m++] = i;
+	if(!m)
+		used[m++] = 0;
+
+	for(i=0;i<128;i++)
+		tune[i] = tune_cv(i);
+
+	// keys count scale steps from x = 1 on the bottom row
+	for(y=0;y<8;y++)
+		for(x=0;x<16;x++) {
+			k = x + (7-y) * es.tune.row;
+			k = k ? k - 1 : 0;
+			key_cv[y][x] = min(tune_cv((k / m) * d + used[k % m]), 4095);
+		}
+
+	quant_resolve();
+}
+
+static void tune_check(void) {
+	if(es.tune.kind >= tunCount)
+		es.tune.kind = tunEdo;
+	if(!es.tune.edo || es.tune.edo > TUNE_EDO_MAX)
+		es.tune.edo = 12;
+	if(!es.tune.degrees || es.tune.degrees > TUNE_DEGREES)
+		es.tune.degrees = 1;
+	if(!es.tune.row || es.tune.row > 16)
+		es.tune.row = 5;
+}
+
+static void tune_default(void) {
+	u8 i;
+
+	es.tune.kind = tunEdo;
+	es.tune.edo = 12;
+	es.tune.degrees = 12;
+	es.tune.row = 5;
+	es.tune.scale = 0;
+	for(i=0;i<TUNE_DEGREES;i++)
+		es.tune.custom[i] = i < 12 ? (i * 4096) / 12 : 0;
+}
+
 
-		spi_selectChip(SPI,DAC_SPI_NPCS);
 
-		spi_write(SPI,0x38);	// update B
-		spi_write(SPI,aout[3].now>>4);
-		spi_write(SPI,aout[3].now<<4);
+////////////////////////////////////////////////////////////////////////////////
+// note output
+//
+// live, pattern and midi notes all take the same path: note_hold stops
+// cvTimer, note_pitch and note_shape set the outputs up, note_commit sends
+// them in one dac write and lets cvTimer go again, and only then does the
+// gate move. pitch and cv lead the gate by the same amount whatever played
+// the note.
+
+static inline u16 key_pitch(u8 x, u8 y) {
+	return key_cv[y][x];
+}
 
-		spi_write(SPI,0x80);	// update B
-		spi_write(SPI,0xff);
-		spi_write(SPI,0xff);
+static inline void note_hold(void) {
+	slew_active = 0;
+}
 
-		spi_unselectChip(SPI,DAC_SPI_NPCS);
+static void note_pitch(u16 cv) {
+	aout[3].target = cv;
 
-		// cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+	if(port_active)
+		slew_start(3, (aout[3].slew >> 2) + 1, es.curve[3]);
+	else {
+		aout[3].step = 0;
+		aout[3].now = cv;
 	}
+}
 
-	if(s == 0)
+// 0 is a single key, otherwise shape s-1 takes over the cv outputs
+static void note_shape(u8 s) {
+	u8 i;
+
+	if(s == 0) {
 		singled = 1;
-	else {
-		if(shape_on != (s-1)) {
-			shape_on = s-1;
-
-			for(i=0;i<3;i++) {
-				// don't change CV if above thresh
-				if(es.slew[shape_on][i] < SLEW_CV_OFF_THRESH) {
-					aout[i].target = es.cv[shape_on][i];
-					aout[i].slew = es.slew[shape_on][i];
-
-					aout[i].step = EXP[aout[i].slew >> 4] + 1;
-					aout[i].delta = ((aout[i].target - aout[i].now)<<16) / aout[i].step;
-					aout[i].a = aout[i].now<<16;
-				}
-			}
+		return;
+	}
+
+	if(shape_on != (s-1)) {
+		shape_on = s-1;
 
-			reset_hys();
+		for(i=0;i<3;i++) {
+			// don't change CV if above thresh
+			if(es.slew[shape_on][i] < SLEW_CV_OFF_THRESH) {
+				aout[i].target = es.cv[shape_on][i];
+				aout[i].slew = es.slew[shape_on][i];
+
+				if(slew_stale[shape_on] & (1 << i))
+					slew_cache(shape_on, i);
+				slew_go(i, slew_steps[shape_on][i], slew_inc[shape_on][i], es.curve[i]);
+			}
 		}
 
-		singled = 0;
+		reset_hys();
 	}
 
+	singled = 0;
+}
+
+static void note_commit(void) {
+	aout_write();
+	slew_active = 1;
+
+	// print_dbg("\r\nnote // p:");
+	// print_dbg_ulong(aout[3].target);
+	// print_dbg(" 0: "); print_dbg_ulong(aout[0].target);
+	// print_dbg(" 1: "); print_dbg_ulong(aout[1].target);
+	// print_dbg(" 2: "); print_dbg_ulong(aout[2].target);
+}
+
+static void note_gate(u8 s, u8 x, u8 y) {
 	if(es.edge == eDrone) {
-		if(root_x == x && root_y == y && edge_state) {
-			gpio_clr_gpio_pin(B00);
-			edge_state = 0;
-		}
-		else {
-			gpio_set_gpio_pin(B00);
-			edge_state = 1;
-		}
+		if(root_x == x && root_y == y && edge_state)
+			gate_off();
+		else
+			gate_on();
 	}
 	else if(s<5) {
-		gpio_set_gpio_pin(B00);
-		edge_state = 1;
-
 		if(es.edge == eFixed) {
-			edge_counter = (EXP[es.edge_fixed_time]>>2) + 2;
+			gate_pulse(((EXP[es.edge_fixed_time]>>2) + 1) * GATE_UNIT_US);
 			// print_dbg("\r\ntrig fixed: ");
-			// print_dbg_ulong(edge_counter);
+			// print_dbg_ulong(es.edge_fixed_time);
 		}
+		else
+			gate_on();
+	}
+}
+
+static void shape(u8 s, u8 x, u8 y) {
+	// print_dbg("\r\nfound shape: ");
+	// print_dbg_ulong(s);
+
+	note_hold();
+
+	// PATTERN PLAY MODE
+	if(arp && r_status == rOff && s<4) {
+		es.p[p_select].x = x - es.p[p_select].e[0].x;
+		es.p[p_select].y = y - es.p[p_select].e[0].y;
 	}
+	else if(s<5)
+		note_pitch(key_pitch(x, y));
+
+	note_shape(s);
+	note_commit();
+	note_gate(s, x, y);
 
 	if(arp && r_status == rOff && s<5 && !legato)
 		play();
@@ -1395,100 +3512,30 @@ static void shape(u8 s, u8 x, u8 y) {
 
 
 // this gets called by the pattern recorder
-static void pattern_shape(u8 s, u8 x, u8 y) {
-	u8 i;
-
+// out masks what this call may touch, see ph_outputs()
+static void pattern_shape(u8 s, u8 x, u8 y, u8 out) {
 	// print_dbg("\r\nfound shape: ");
 	// print_dbg_ulong(s);
 
 	if(s == 100) {
-		if(es.edge == eStandard) {
-			gpio_clr_gpio_pin(B00);
-			edge_state = 0;
-		}
+		if(es.edge == eStandard && (out & OUT_GATE))
+			gate_off();
 	}
 	else {
-		// cv_pos = SCALES[0][x] + (7-y)*170;
-
-		aout[3].target = SEMI[(x+(7-y)*5) - 1];
-		// aout[3].target = TONE[x*scale[scale_x]+(7-y)*scale[scale_y]];
-
-
-		if(port_active) {
-			aout[3].step = (aout[3].slew >> 2) + 1;
-			aout[3].delta = ((aout[3].target - aout[3].now)<<16) / aout[3].step;
-			aout[3].a = aout[3].now<<16;
-		}
-		else {
-			aout[3].now = aout[3].target;
-		}
-
-		if(!port_active) {
-			// cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
-
-			spi_selectChip(SPI,DAC_SPI_NPCS);
-
-			spi_write(SPI,0x38);	// update B
-			spi_write(SPI,aout[3].now>>4);
-			spi_write(SPI,aout[3].now<<4);
-
-			spi_write(SPI,0x80);	// update B
-			spi_write(SPI,0xff);
-			spi_write(SPI,0xff);
-
-			spi_unselectChip(SPI,DAC_SPI_NPCS);
-			// cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
-		}
-
-		if(s == 0) {
-			singled = 1;
-		}
-		else {
-			if(shape_on != (s-1)) {
-				shape_on = s-1;
-
-				for(i=0;i<3;i++) {
-					// don't change CV if above thresh
-					if(es.slew[shape_on][i] < SLEW_CV_OFF_THRESH) {
-						aout[i].target = es.cv[shape_on][i];
-						aout[i].slew = es.slew[shape_on][i];
-
-						aout[i].step = EXP[aout[i].slew >> 4] + 1;
-						aout[i].delta = ((aout[i].target - aout[i].now)<<16) / aout[i].step;
-						aout[i].a = aout[i].now<<16;
-					}
-				}
-
-				reset_hys();
-			}
-
-			singled = 0;
-		}
-
-		if(es.edge == eDrone) {
-			if(root_x == x && root_y == y && edge_state) {
-				gpio_clr_gpio_pin(B00);
-				edge_state = 0;
-			}
-			else {
-				gpio_set_gpio_pin(B00);
-				edge_state = 1;
-			}
-		}
-		else if(s<5) {
-			gpio_set_gpio_pin(B00);
-			edge_state = 1;
-
-			if(es.edge == eFixed) {
-				edge_counter = (EXP[es.edge_fixed_time]>>2) + 2;
-				// print_dbg("\r\ntrig fixed: ");
-				// print_dbg_ulong(edge_counter);
-			}
+		note_hold();
+		if(out & OUT_PITCH)
+			note_pitch(key_pitch(x, y));
+		if(out & OUT_SHAPE)
+			note_shape(s);
+		note_commit();
+
+		if(out & OUT_GATE)
+			note_gate(s, x, y);
+
+		if(out & OUT_PITCH) {
+			root_x = x;
+			root_y = y;
 		}
-
-
-		root_x = x;
-		root_y = y;
 	}
 
 	monomeFrameDirty++;
@@ -1515,6 +3562,7 @@ static void refresh() {
 	// REC STATUS
 	if(r_status == rArm) monomeLedBuffer[32] = 7;
 	else if(r_status == rRec) monomeLedBuffer[32] = 11 + 4 * (blinker < 24);
+	else if(r_status == rDub) monomeLedBuffer[32] = 7 + 8 * (blinker < 24);
 
 	// LOOP and MODE
 	if(es.p[p_select].loop) monomeLedBuffer[48] = 11;
@@ -1524,8 +3572,8 @@ static void refresh() {
 	if(mode == mBank) monomeLedBuffer[16] = 11;
 
 	// PATTERN INDICATION
-	if(p_playing) {
-		i2 = p_timer_total / (es.p[p_select].total_time / 16);
+	if(ph[0].playing) {
+		i2 = ph_elapsed(0) / (es.p[ph[0].pattern].total_time / 16);
 
 		for(i1=0;i1<16;i1++)
 			if(i1 < i2) monomeLedBuffer[i1] = 4;
@@ -1568,6 +3616,14 @@ static void refresh() {
 
 		monomeLedBuffer[34 + (p_select%4) + (p_select / 4) * 16] = 15;
 
+		if(sw_pending)
+			monomeLedBuffer[34 + (sw_pattern%4) + (sw_pattern / 4) * 16] = 11;
+
+		for(i1=0;i1<XF_SLOTS;i1++)
+			if(es.xf[i1][0].op != xfEnd) monomeLedBuffer[39+i1] = 7;
+
+		if(undo_pos) monomeLedBuffer[87] = 7;
+		if(undo_pos < undo_count) monomeLedBuffer[88] = 7;
 	}
 	// STATE
 	else {
@@ -1665,6 +3721,7 @@ static void refresh_mono() {
 	// REC STATUS
 	if(r_status == rArm) monomeLedBuffer[32] = 15;
 	else if(r_status == rRec) monomeLedBuffer[32] = 15 * (blinker < 24);
+	else if(r_status == rDub) monomeLedBuffer[32] = 15 * (blinker < 12);
 
 	// LOOP and MODE
 	if(es.p[p_select].loop) monomeLedBuffer[48] = 15;
@@ -1674,8 +3731,8 @@ static void refresh_mono() {
 	if(mode == mBank) monomeLedBuffer[16] = 15;
 
 	// PATTERN INDICATION
-	if(p_playing) {
-		i2 = p_timer_total / (es.p[p_select].total_time / 16);
+	if(ph[0].playing) {
+		i2 = ph_elapsed(0) / (es.p[ph[0].pattern].total_time / 16);
 
 		for(i1=0;i1<16;i1++)
 			if(i1 < i2) monomeLedBuffer[i1] = 15;
@@ -1713,6 +3770,11 @@ static void refresh_mono() {
 
 		monomeLedBuffer[34 + (p_select%4) + (p_select / 4) * 16] = (blinker < 24) * 15;
 
+		for(i1=0;i1<XF_SLOTS;i1++)
+			if(es.xf[i1][0].op != xfEnd) monomeLedBuffer[39+i1] = 15;
+
+		if(undo_pos) monomeLedBuffer[87] = 15;
+		if(undo_pos < undo_count) monomeLedBuffer[88] = 15;
 	}
 	// STATE
 	else {
@@ -1817,9 +3879,63 @@ static void refresh_preset() {
 
 
 
+// runs in the twi interrupt, so it only copies the frame for check_events.
+// ES_CLOCK is stamped for tempo here and, with nothing queued ahead of it to
+// keep in order, left for the next clock tick to step the playheads. nothing
+// here touches them, so it can't land in the middle of the timer's ph_run or
+// a main loop change to a playhead.
+static void es_ii_receive(uint8_t *data, uint8_t l) {
+	u8 i, n;
+
+	if(l < 1)
+		return;
+
+	// reads are answered from the snapshot, nothing is worked out here
+	if(data[0] == ES_GET) {
+		n = l > 1 && data[1] < snCount ? data[1] : snPlaying;
+		ii_tx_queue(ii_snap[n] >> 8);
+		ii_tx_queue(ii_snap[n] & 0xff);
+		return;
+	}
+
+	if(data[0] == ES_CLOCK && l == 3 && (data[1] || data[2])) {
+		ext_pulse(&clk_ii, Get_sys_count());
+		if(i2c_rd == i2c_wr) {
+			ii_pulse_wr++;
+			return;
+		}
+	}
+
+	// a clock inside a batch is still stamped on arrival
+	for(i=3;i+2<l;i+=3)
+		if(data[i] == ES_CLOCK && (data[i+1] || data[i+2])) {
+			ext_pulse(&clk_ii, Get_sys_count());
+			break;
+		}
+
+	n = (i2c_wr + 1) & (I2C_QUEUE - 1);
+	if(n == i2c_rd) {
+		i2c_overflow++;
+		// print_dbg("\r\nii overflow");
+		return;
+	}
+
+	if(l > I2C_FRAME)
+		l = I2C_FRAME;
+	for(i=0;i<l;i++)
+		i2c_queue[i2c_wr].data[i] = data[i];
+	i2c_queue[i2c_wr].l = l;
+	i2c_wr = n;
+
+	n = (i2c_wr - i2c_rd) & (I2C_QUEUE - 1);
+	if(n > i2c_waiting_count)
+		i2c_waiting_count = n;
+}
+
 static void es_process_ii(uint8_t *data, uint8_t l) {
     uint8_t command = data[0];
 	int d = (data[1] << 8) + data[2];
+	u8 i, n;
 
     switch(command) {
 		case ES_PRESET:
@@ -1830,107 +3946,236 @@ static void es_process_ii(uint8_t *data, uint8_t l) {
 			monomeFrameDirty++;
 			break;
 		case ES_MODE:
-			if(d)
-				clock_mode = 1;
-			else
-				clock_mode = 0;
+			ph_clock(0, d == phClockExt ? phClockExt : d ? phClockII : phClockInt);
 			break;
 		case ES_CLOCK:
-			if(d && clock_mode) {
-				if(p_play_pos == es.p[p_select].length && !es.p[p_select].loop) {
-					// print_dbg("\r\nPATTERN DONE");
-					p_playing = 0;
+			if(d) {
+				ph_pulse();
+				monomeFrameDirty++;
+			}
+			break;
+		case ES_RESET:
+			if(d) {
+				if(r_status == rRec) {
+					rec_stop();
+					r_status = rOff;
+					play();
 				}
-				else {
-					if(p_play_pos == es.p[p_select].length && es.p[p_select].loop) {
-						// print_dbg("\r\nLOOP");
-						p_play_pos = 0;
-						p_timer_total = 0;
-					}
-
-					u8 i = p_play_pos;
-					p_timer_total += es.p[p_select].e[i].interval;
-
-					s8 x = es.p[p_select].e[i].x + es.p[p_select].x;
-					s8 y = es.p[p_select].e[i].y + es.p[p_select].y;
-
-					if(x<0) x = 0;
-					else if(x>15) x=15;
-					if(y<0) y = 0;
-					else if(y>7) y=7;
-
-
-					// print_dbg("\r\n");
-					// print_dbg_ulong(i);
-					// print_dbg(" : ");
-					// print_dbg_ulong(es.p[p_select].e[i].shape);
-					// print_dbg(" @ (");
-					// print_dbg_ulong(es.p[p_select].e[i].x);
-					// print_dbg(", ");
-					// print_dbg_ulong(es.p[p_select].e[i].y);
-					// print_dbg(")   NEXT: ");
-					// print_dbg_ulong(es.p[p_select].e[i].interval);
-
-					pattern_shape(es.p[p_select].e[i].shape, (u8)x, (u8)y);
-
-
-					p_play_pos++;
-
+				play();
+			}
+			break;
+		case ES_PATTERN:
+			if(d < 0 || d > 15)
+				break;
+			if(ph[0].playing) {
+				pattern_switch(d);
+			}
+			else {
+				stop();
+				p_select = d;
+			}
+			break;
+		case ES_TRANS:
+			d = (short)d;
+			es.p[p_select].x = (d % 5);
+			es.p[p_select].y = -(d / 5);
+			break;
+		case ES_STOP:
+			if(d) {
+				if(r_status == rRec) {
+					rec_stop();
+					r_status = rOff;
 				}
-
-				monomeFrameDirty++;
+				stop();
+			}
+			break;
+		case ES_TRIPLE:
+			if(d<1 || d>4)
+				break;
+			pattern_shape(d+4,root_x,root_y,OUT_ALL);
+			break;
+		case ES_MAGIC:
+			if(d==1)
+				pattern_time_double();
+			else if(d==2)
+				pattern_time_half();
+			else if(d==3)
+				pattern_linearize();
+ 			break;
+		case ES_PH_PLAY:
+			if(data[1] >= PLAYHEADS || data[2] > 15)
+				break;
+			if(data[1] == 0) {
+				p_select = data[2];
+				play();
+			}
+			else
+				ph_play(data[1], data[2]);
+			break;
+		case ES_PH_STOP:
+			if(data[1] >= PLAYHEADS)
+				break;
+			if(data[1] == 0)
+				stop();
+			else
+				ph_stop(data[1]);
+			break;
+		case ES_PH_TRANS:
+			if(data[1] >= PLAYHEADS)
+				break;
+			ph[data[1]].x = ((s8)data[2] % 5);
+			ph[data[1]].y = -((s8)data[2] / 5);
+			break;
+		case ES_PH_LOOP:
+			if(data[1] < PLAYHEADS && data[2] <= phLoopOff)
+				ph[data[1]].loop = data[2];
+			break;
+		case ES_PH_CLOCK:
+			if(data[1] < PLAYHEADS)
+				ph_clock(data[1], data[2] == phClockExt ? phClockExt : data[2] ? phClockII : phClockInt);
+			break;
+		case ES_PH_OUT:
+			if(data[1] < PLAYHEADS)
+				ph[data[1]].out = data[2] & OUT_ALL;
+			break;
+		case ES_ARB:
+			ph_arb = d ? arbLowest : arbLatest;
+			break;
+		case ES_RATE:
+			pattern_rate(p_select, d);
+			break;
+		case ES_XF_ADD:
+			if((data[1] >> 4) >= XF_SLOTS || (data[1] & 0xf) == xfEnd || (data[1] & 0xf) >= xfCount)
+				break;
+			for(i=0;i<XF_OPS;i++)
+				if(es.xf[data[1] >> 4][i].op == xfEnd) {
+					es.xf[data[1] >> 4][i].op = data[1] & 0xf;
+					es.xf[data[1] >> 4][i].arg = data[2];
+					break;
+				}
+			break;
+		case ES_XF_CLEAR:
+			if(d >= 0 && d < XF_SLOTS)
+				for(i=0;i<XF_OPS;i++)
+					es.xf[d][i].op = xfEnd;
+			break;
+		case ES_XF_RUN:
+			if(d >= 0 && d < XF_SLOTS)
+				pattern_transform(p_select, es.xf[d]);
+			break;
+		case ES_SW_DIV:
+			if(d >= 0 && d < 65)
+				es.sw_div = d;
+			break;
+		case ES_CHAIN:
+			if(d)
+				chain_start();
+			else
+				chain_on = 0;
+			break;
+		case ES_CHAIN_SET:
+			if(data[1] < CHAIN_STEPS) {
+				es.chain[data[1]].pattern = data[2] & 0xf;
+				es.chain[data[1]].repeats = data[2] >> 4;
+			}
+			break;
+		case ES_SEEK:
+			if(d >= 0)
+				ph_seek(0, d);
+			break;
+		case ES_SEEK_FRAC:
+			if(d >= 0 && d < 16384)
+				ph_seek(0, ((u32)es.p[ph[0].playing ? ph[0].pattern : p_select].total_time * d) >> 14);
+			break;
+		case ES_PH_SEEK:
+			if(data[1] < PLAYHEADS)
+				ph_seek(data[1], ((u32)es.p[ph[data[1]].pattern].total_time * data[2]) >> 8);
+			break;
+		case ES_RATIO:
+			if(data[1] && data[1] <= RATIO_MAX && data[2] && data[2] <= RATIO_MAX) {
+				es.p[p_select].mul = data[1];
+				es.p[p_select].div = data[2];
 			}
 			break;
-		case ES_RESET:
-			if(d) {
-				if(r_status == rRec) {
-					rec_stop();
-					r_status = rOff;
-					play();
-				}
-				play();
+		case ES_TUNE:
+			if(data[1] < tunCount) {
+				es.tune.kind = data[1];
+				if(data[1] == tunEdo && data[2] && data[2] <= TUNE_EDO_MAX)
+					es.tune.edo = data[2];
+				else if(data[1] == tunCustom && data[2] && data[2] <= TUNE_DEGREES)
+					es.tune.degrees = data[2];
+				tune_resolve();
 			}
 			break;
-		case ES_PATTERN:
-			if(d < 0 || d > 15)
-				break;
-			if(p_playing) {
-				stop();
-				p_select = d;
-				play();
+		case ES_TUNE_SET:
+			es.tune.custom[(data[1] >> 4) & (TUNE_DEGREES - 1)] = d & 0xfff;
+			tune_resolve();
+			break;
+		case ES_SCALE:
+			if(data[1] < 4) {
+				es.tune.scale &= ~((u32)0xff << (data[1] * 8));
+				es.tune.scale |= (u32)data[2] << (data[1] * 8);
+				tune_resolve();
 			}
-			else {
-				stop();
-				p_select = d;
+			break;
+		case ES_ROW:
+			if(d >= 1 && d <= 16) {
+				es.tune.row = d;
+				tune_resolve();
 			}
 			break;
-		case ES_TRANS:
-			d = (short)d;
-			es.p[p_select].x = (d % 5);
-			es.p[p_select].y = -(d / 5);
+		case ES_QUANT:
+			es.quant = d & 7;
+			aout_sent[0] = aout_sent[1] = aout_sent[2] = 0xffff;
 			break;
-		case ES_STOP:
-			if(d) {
-				if(r_status == rRec) {
-					rec_stop();
-					r_status = rOff;
-				}
-				stop();
+		case ES_QSCALE:
+			if(data[1] < 4) {
+				es.qscale &= ~((u32)0xff << (data[1] * 8));
+				es.qscale |= (u32)data[2] << (data[1] * 8);
+				quant_resolve();
 			}
 			break;
-		case ES_TRIPLE:
-			if(d<1 || d>4)
-				break;
-			pattern_shape(d+4,root_x,root_y);
+		case ES_CAL_OFS:
+		case ES_CAL_GAIN:
+			if(data[1] < 4) {
+				if(data[0] == ES_CAL_OFS)
+					cal.ofs[data[1]] = (s8)data[2];
+				else
+					cal.gain[data[1]] = (s8)data[2];
+				cal_reset(data[1]);
+			}
+			break;
+		case ES_CAL_POINT:
+			i = data[1] >> 5;
+			n = data[1] & 0x1f;
+			if(i < 4 && n < CAL_POINTS) {
+				cal.bp[i][n] = cal_line(i, n) + (s8)data[2];
+				aout_sent[i] = 0xffff;
+			}
+			break;
+		case ES_CAL_SAVE:
+			cal_write();
+			break;
+		case ES_CURVE:
+			if(data[1] < 4 && data[2] < curveCount)
+				es.curve[data[1]] = data[2];
+			break;
+		case ES_GROOVE:
+			if(d >= 0 && d < GROOVES)
+				es.p[p_select].groove = d;
+			break;
+		case ES_EXT_PPL:
+			if(d > 0 && d < 256)
+				ext_ppl = d;
+			break;
+		case ES_UNDO:
+			i = 0;
+			do pattern_undo(); while(++i < d && i < UNDO_DEPTH);
+			break;
+		case ES_REDO:
+			i = 0;
+			do pattern_redo(); while(++i < d && i < UNDO_DEPTH);
 			break;
-		case ES_MAGIC:
-			if(d==1)
-				pattern_time_double();
-			else if(d==2)
-				pattern_time_half();
-			else if(d==3)
-				pattern_linearize();
- 			break;
 		default:
 			break;
 	}
@@ -1980,24 +4225,29 @@ inline static u16 blend(u8 num, u8 mix) {
 	return v;
 }
 
-inline static void aout_set_pitch(u8 num) {
-	aout[3].target = SEMI[num] + pitch_offset;
-	if (port_active) { // portemento active
-		aout[3].step = (aout[3].slew >> 2) + 1;
-		aout[3].delta = ((aout[3].target - aout[3].now)<<16) / aout[3].step;
-		aout[3].a = aout[3].now<<16;
-	}
-	else {
-		aout[3].now = aout[3].target;
-	}
+inline static u16 pitch_bent(u8 num) {
+	s32 t = tune[num] + pitch_offset;
+
+	if (t < 0) t = 0;
+	else if (t > 4095) t = 4095;
+
+	return t;
+}
+
+static void bend_range_set(u8 range) {
+	// one semitone is 4096 / 120 codes and half the bend is 8192 steps, so
+	// offset = bend * range / 240. keep it as 16.16 so bends just multiply.
+	if (range < 1) range = 1;
+	else if (range > MIDI_BEND_RANGE_MAX) range = MIDI_BEND_RANGE_MAX;
+
+	es.bend_range = range;
+	bend_scale = ((u32)range << 16) / 240;
 }
 
 inline static void aout_set_pitch_slew(u8 num, u8 port_time) {
-	// like aout_set_pitch but always slews with the given amount [0,256]
-	aout[3].target = SEMI[num] + pitch_offset;
-	aout[3].step = (EXP[port_time] >> 2) + 1;
-	aout[3].delta = ((aout[3].target - aout[3].now)<<16) / aout[3].step;
-	aout[3].a = aout[3].now<<16;
+	// like note_pitch but always slews with the given amount [0,256]
+	aout[3].target = pitch_bent(num);
+	slew_start(3, (EXP[port_time] >> 2) + 1, es.curve[3]);
 }
 
 inline static void aout_set_velocity(u16 vel) {
@@ -2018,10 +4268,45 @@ inline static void aout_set_tracking(u16 num) {
 	// print_dbg_ulong(aout[1].target);
 }
 
-inline static void aout_set_a0(u8 num) {
-	// TODO: support non-linear mappings?
-	aout[0].target = num << 5;
-	aout[0].now = aout[0].target;
+inline static u16 cc_scale(u8 curve, u16 v) {
+	// v: 14-bit [0, 16383] -> [0, 4096), curves interpolate between entries
+	const u16 *t;
+	u16 i, a, b;
+
+	switch (curve) {
+		case ccLog:
+			t = LOG;
+			break;
+		case ccExp:
+			t = EXP2;
+			break;
+		default:
+			return v >> 2;
+	}
+
+	i = v >> 7;
+	a = t[i];
+	b = i < 127 ? t[i + 1] : 4095;
+
+	return a + (((b - a) * (v & 0x7f)) >> 7);
+}
+
+inline static void aout_set_cc(u8 i, u16 cv, u8 smooth) {
+	// no dac write here, cvTimer picks the new value up on its next pass so a
+	// dense cc stream never blocks on spi. the timer is held off so it never
+	// steps an output with a new step count and the old delta.
+	if (!smooth)
+		smooth = EXP[es.midi_slew[i]] >> 2;
+
+	cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+	aout[i].target = cv;
+	if (smooth)
+		slew_start(i, smooth, es.curve[i]);
+	else {
+		aout[i].step = 0;
+		aout[i].now = aout[i].target;
+	}
+	cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
 }
 
 static void aout_clear(void) {
@@ -2040,6 +4325,15 @@ static void midi_note_on(u8 ch, u8 num, u8 vel) {
 	// print_dbg(" vel: ");
 	// print_dbg_ulong(vel);
 
+	if (cc_learn && cc_learn_num != MIDI_CC_LEARN_NONE) {
+		// learn: note picks destination, octave picks curve, velocity smoothing
+		es.cc[cc_learn_num].dest = num % ccDestCount;
+		es.cc[cc_learn_num].curve = (num / 12) % ccCurveCount;
+		es.cc[cc_learn_num].smooth = vel >> 3;
+		cc_learn = 2;
+		return;
+	}
+
 	if (num > MIDI_NOTE_MAX)
 		// drop notes outside CV range
 		return;
@@ -2047,23 +4341,12 @@ static void midi_note_on(u8 ch, u8 num, u8 vel) {
 	// keep track of held notes for legato
 	notes_hold(&notes, num, vel);
 
-	// suspend slew cvTimer
-	slew_active = 0;
-	aout_set_pitch(num);
+	note_hold();
+	note_pitch(pitch_bent(num));
 	aout_set_velocity(vel);
 	aout_set_tracking(num);
-	aout_write();
-
-	// print_dbg("\r\n    dac // p:");
-	// print_dbg_ulong(aout[3].target);
-	// print_dbg(" v: ");
-	// print_dbg_ulong(aout[2].target);
-	// print_dbg(" t: ");
-	// print_dbg_ulong(aout[1].target);
-
-	gpio_set_gpio_pin(B00);
-
-	slew_active = 1;
+	note_commit();
+	gate_on();
 
 	reset_hys(); // FIXME: why? is this really correct?
 }
@@ -2091,21 +4374,19 @@ static void midi_note_off(u8 ch, u8 num, u8 vel) {
 				// print_dbg(" vel: ");
 				// print_dbg_ulong(prior->vel);
 
-				slew_active = 0;
-				aout_set_pitch(prior->num);
+				note_hold();
+				note_pitch(pitch_bent(prior->num));
 				aout_set_velocity(prior->vel);
 				aout_set_tracking(prior->num);
-				aout_write();
-				slew_active = 1;
+				note_commit();
 				// retrigger edge?
 			}
-			else {
-				gpio_clr_gpio_pin(B00);
-			}
+			else
+				gate_off();
 		}
 		else {
 			// no legato mode
-			gpio_clr_gpio_pin(B00);
+			gate_off();
 		}
 	}
 }
@@ -2122,30 +4403,21 @@ static void midi_pitch_bend(u8 ch, u16 bend) {
 	// print_dbg_ulong(ch);
 	// print_dbg(" bend: ");
 	// print_dbg_ulong(bend);
-	if (bend == MIDI_BEND_ZERO) {
-		pitch_offset = 0;
-	}
-	else if (bend > MIDI_BEND_ZERO) {
-		bend -= MIDI_BEND_ZERO;
-		pitch_offset = BEND1[bend >> 4];
-	}
-	else {
-		bend = MIDI_BEND_ZERO - bend - 1;
-		pitch_offset = -BEND1[bend >> 4];
-	}
+	if (bend >= MIDI_BEND_ZERO)
+		pitch_offset = ((u32)(bend - MIDI_BEND_ZERO) * bend_scale) >> 16;
+	else
+		pitch_offset = -(s16)(((u32)(MIDI_BEND_ZERO - bend) * bend_scale) >> 16);
 
-	// re-set pitch to pick up changed offset
+	// re-set pitch to pick up changed offset, cvTimer does the dac write
 	const held_note_t *active = notes_get(&notes, kNotePriorityLast);
-	if (active) {
-		aout_set_pitch_slew(active->num, MIDI_BEND_SLEW);  // TODO: make slew configurable
-		aout_write();
-	}
+	if (active)
+		aout_set_pitch_slew(active->num, es.midi_slew[3]);
 }
 
 static void midi_sustain(u8 ch, u8 val) {
 	if (val < 64) {
 		notes_init(&notes);
-		gpio_clr_gpio_pin(B00);
+		gate_off();
 		sustain_active = 0;
 	}
 	else {
@@ -2153,6 +4425,53 @@ static void midi_sustain(u8 ch, u8 val) {
 	}
 }
 
+static void cc_dispatch(u8 ch, const cc_route_t *r, u16 v) {
+	// v is 14-bit, plain 7-bit controllers arrive as (val << 7)
+	u16 cv;
+	s16 d;
+
+	switch (r->dest) {
+		case ccA0:
+		case ccA1:
+		case ccA2:
+		case ccA3:
+			aout_set_cc(r->dest - ccA0, cc_scale(r->curve, v), r->smooth);
+			break;
+		case ccSlew0:
+		case ccSlew1:
+		case ccSlew2:
+			cv = cc_scale(r->curve, v);
+			es.slew[shape_on][r->dest - ccSlew0] = aout[r->dest - ccSlew0].slew = cv;
+			slew_touch(shape_on, r->dest - ccSlew0);
+			break;
+		case ccPort:
+			port_time = cc_scale(r->curve, v) >> 4;
+			aout[3].slew = EXP[port_time];
+			break;
+		case ccSustain:
+			midi_sustain(ch, v >> 7);
+			break;
+		case ccPattern:
+			// a knob sends the same value many times, only act on a new one
+			if ((v >> 10) == p_select)
+				break;
+			if (ph[0].playing)
+				pattern_switch(v >> 10);
+			else {
+				stop();
+				p_select = v >> 10;
+			}
+			break;
+		case ccTrans:
+			d = (s16)(v >> 7) - 64;
+			es.p[p_select].x = (d % 5);
+			es.p[p_select].y = -(d / 5);
+			break;
+		default:
+			break;
+	}
+}
+
 static void midi_control_change(u8 ch, u8 num, u8 val) {
 	// print_dbg("\r\n midi_control_change(), ch: ");
 	// print_dbg_ulong(ch);
@@ -2161,37 +4480,370 @@ static void midi_control_change(u8 ch, u8 num, u8 val) {
 	// print_dbg(" val: ");
 	// print_dbg_ulong(val);
 
+	num &= 0x7f;
+	val &= 0x7f;
+
+	// don't let the lsb of a 14-bit pair steal the learn from its msb
+	if (cc_learn && !(num >= MIDI_CC_LSB && num - MIDI_CC_LSB == cc_learn_num))
+		cc_learn_num = num;
+
+	if (es.cc[num].dest != ccOff) {
+		if (num < MIDI_CC_LSB)
+			cc_msb[num] = val;
+		cc_dispatch(ch, &es.cc[num], val << 7);
+		return;
+	}
+
+	// unrouted lsb refines its routed msb
+	if (num >= MIDI_CC_LSB && num < (MIDI_CC_LSB << 1)) {
+		num -= MIDI_CC_LSB;
+		if (es.cc[num].dest != ccOff)
+			cc_dispatch(ch, &es.cc[num], (cc_msb[num] << 7) | val);
+		return;
+	}
+
+	// rpn 0 is bend range, nrpn 0-3 is per-output slew
 	switch (num) {
-		case 1:  // mod wheel
-			// TODO: set a small amount of slewing
-			// TODO: implement midi learn buy capturing the controller number when the
-			// front panel button is held down.
-			slew_active = 0;
-			aout_set_a0(val);
-			aout_write(); // should we just write the one?
-			slew_active = 1;
+		case MIDI_CC_RPN_MSB:
+		case MIDI_CC_RPN_LSB:
+		case MIDI_CC_NRPN_MSB:
+		case MIDI_CC_NRPN_LSB:
+			if (num & 1) rpn_msb = val;
+			else rpn_lsb = val;
+			rpn_nrpn = num < MIDI_CC_RPN_LSB;
+			break;
+		case MIDI_CC_DATA:
+			if (rpn_msb != 0)
+				break;
+			if (!rpn_nrpn && rpn_lsb == 0)
+				bend_range_set(val);
+			else if (rpn_nrpn && rpn_lsb < 4)
+				es.midi_slew[rpn_lsb] = val << 1;
+			break;
+		default:
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sysex preset/pattern transfer
+//
+// all messages are F0 7D 45 <version> <cmd> ... F7, version is FIRSTRUN_KEY so
+// dumps only load into firmware with the same flash layout.
+//
+//   request  <kind> <preset> <pattern>
+//   chunk    <kind> <preset> <pattern> <seq lo> <seq hi> <data...> <sum>
+//   done     <kind> <preset> <pattern> <seq lo> <seq hi> <check x3> <sum>
+//   ack/nak  <seq lo> <seq hi>
+//
+// data is 7-in-8 packed, sum is the low 7 bits of the sum of everything after
+// <cmd>. done carries a fletcher-16 of the whole image in 7 bit pieces and
+// ends the transfer. the sender waits for an ack per message, so a transfer
+// only ever holds one message worth of event queue and notes keep flowing in
+// between.
+//
+// a load is written to flashy.scratch and only copied over the preset or
+// pattern once every byte has arrived and the check matches, so a cable
+// pulled halfway leaves the old data alone. tools/es_sysex.py builds and
+// reads the same messages on a computer.
+
+static u8 sysex_pack(u8 *dst, const u8 *src, u8 len) {
+	// 7 bytes in, 8 out: a byte of msbs then the low 7 bits of each
+	u8 i, j, n = 0;
+	u8 *hi;
+
+	for (i = 0; i < len; i += 7) {
+		hi = &dst[n++];
+		*hi = 0;
+		for (j = 0; j < 7 && i + j < len; j++) {
+			*hi |= (src[i + j] >> 7) << j;
+			dst[n++] = src[i + j] & 0x7f;
+		}
+	}
+
+	return n;
+}
+
+static u8 sysex_unpack(u8 *dst, const u8 *src, u8 len) {
+	u8 i, j, n = 0;
+
+	for (i = 0; i < len; i += 8)
+		for (j = 1; j < 8 && i + j < len; j++)
+			dst[n++] = src[i + j] | (((src[i] >> (j - 1)) & 1) << 7);
+
+	return n;
+}
+
+static u8 sysex_sum(const u8 *b, u8 len) {
+	u8 sum = 0;
+
+	while (len--)
+		sum += *b++;
+
+	return sum & 0x7f;
+}
+
+static u16 sysex_check(const u8 *b, u16 len) {
+	u16 s1 = 0, s2 = 0;
+
+	while (len--) {
+		s1 = (s1 + *b++) % 255;
+		s2 = (s2 + s1) % 255;
+	}
+
+	return (s2 << 8) | s1;
+}
+
+static u8 sysex_header(u8 *b, u8 cmd) {
+	b[0] = 0xf0;
+	b[1] = SYSEX_MANUFACTURER;
+	b[2] = SYSEX_DEVICE;
+	b[3] = FIRSTRUN_KEY & 0x7f;
+	b[4] = cmd;
+	return 5;
+}
+
+static void sysex_send(const u8 *b, u8 len) {
+	u8 i;
+
+	for (i = 0; i < len; i += 3)
+		midi_write(&b[i], min(3, len - i));
+}
+
+static void sysex_send_seq(u8 cmd, u16 seq) {
+	u8 b[8];
+	u8 n = sysex_header(b, cmd);
+
+	b[n++] = seq & 0x7f;
+	b[n++] = seq >> 7;
+	b[n++] = 0xf7;
+	sysex_send(b, n);
+}
+
+static u8 sysex_target(u8 kind, u8 preset, u8 pattern) {
+	if (preset > 7 || pattern > 15)
+		return 0;
+
+	sysex.kind = kind;
+	sysex.preset = preset;
+	sysex.pattern = pattern;
+	sysex.seq = 0;
+
+	if (kind == sxPreset) {
+		sysex.flash = (u8 *)&flashy.es[preset];
+		sysex.size = sizeof(es_set);
+	}
+	else if (kind == sxPattern) {
+		sysex.flash = (u8 *)&flashy.es[preset].p[pattern];
+		sysex.size = sizeof(pattern_t);
+	}
+	else
+		return 0;
+
+	return 1;
+}
+
+static void sysex_send_chunk(void) {
+	// encoded straight out of flash, nothing is staged in ram
+	u8 b[SYSEX_RX_MAX];
+	u8 n, len = 0;
+	u16 off = sysex.seq * SYSEX_CHUNK;
+	u16 check;
+
+	if (off < sysex.size)
+		len = min(SYSEX_CHUNK, sysex.size - off);
+
+	n = sysex_header(b, len ? sxChunk : sxDone);
+	b[n++] = sysex.kind;
+	b[n++] = sysex.preset;
+	b[n++] = sysex.pattern;
+	b[n++] = sysex.seq & 0x7f;
+	b[n++] = sysex.seq >> 7;
+	if (len)
+		n += sysex_pack(&b[n], sysex.flash + off, len);
+	else {
+		check = sysex_check(sysex.flash, sysex.size);
+		b[n++] = check & 0x7f;
+		b[n++] = (check >> 7) & 0x7f;
+		b[n++] = check >> 14;
+	}
+	b[n] = sysex_sum(&b[5], n - 5);
+	n++;
+	b[n++] = 0xf7;
+
+	sysex_send(b, n);
+
+	if (len == 0)
+		sysex.state = sxIdle;
+}
+
+static void sysex_flush(void) {
+	if (sysex.fill) {
+		flashc_memcpy((void *)(flashy.scratch + sysex.base), sysex.page, sysex.fill, true);
+		sysex.base += sysex.fill;
+		sysex.fill = 0;
+	}
+}
+
+static u8 sysex_load_done(u16 check) {
+	pattern_t *p;
+
+	sysex_flush();
+	sysex.state = sxIdle;
+
+	if (sysex.base != sysex.size || sysex_check(flashy.scratch, sysex.size) != check)
+		return 0;
+
+	flashc_memcpy((void *)sysex.flash, flashy.scratch, sysex.size, true);
+
+	if (sysex.preset != preset_select)
+		return 1;
+
+	if (sysex.kind == sxPreset)
+		flash_read();
+	else {
+		// playheads read the pattern from the timer
+		p = &es.p[sysex.pattern];
+		cpu_irq_disable_level(APP_TC_IRQ_PRIORITY);
+		*p = flashy.es[sysex.preset].p[sysex.pattern];
+		pattern_check(p);
+		cpu_irq_enable_level(APP_TC_IRQ_PRIORITY);
+		ph_refit(sysex.pattern);
+		undo_clear();
+		seek_valid = 0;
+	}
+
+	return 1;
+}
+
+static void sysex_chunk(const u8 *b, u8 len) {
+	// b starts at <kind>, len includes the checksum
+	u8 data[SYSEX_CHUNK];
+	u8 n, c;
+	u16 seq;
+
+	if (len < 6)
+		return;
+
+	seq = b[3] | (b[4] << 7);
+
+	if (seq == 0) {
+		if (!sysex_target(b[0], b[1], b[2]))
+			return;
+		sysex.state = sxLoad;
+		sysex.base = sysex.fill = 0;
+	}
+
+	if (sysex.state != sxLoad || seq != sysex.seq ||
+		b[len - 1] != sysex_sum(b, len - 1)) {
+		sysex_send_seq(sxNak, sysex.seq);
+		return;
+	}
+
+	n = sysex_unpack(data, &b[5], len - 6);
+
+	if (sysex.base + sysex.fill + n > sysex.size) {
+		sysex.state = sxIdle;
+		sysex_send_seq(sxNak, seq);
+		return;
+	}
+
+	// gather into a page so flash sees one erase/write per page, not per chunk
+	for (c = 0; c < n; c++) {
+		sysex.page[sysex.fill++] = data[c];
+		if (sysex.fill == SYSEX_PAGE)
+			sysex_flush();
+	}
+
+	sysex.seq++;
+	sysex_send_seq(sxAck, seq);
+}
+
+static void sysex_done(const u8 *b, u8 len) {
+	// b starts at <kind>, like a chunk
+	u16 seq;
+
+	if (sysex.state != sxLoad || len != 9)
+		return;
+
+	seq = b[3] | (b[4] << 7);
+
+	if (seq != sysex.seq || b[8] != sysex_sum(b, 8) ||
+		!sysex_load_done(b[5] | (b[6] << 7) | ((u16)b[7] << 14))) {
+		sysex.state = sxIdle;
+		sysex_send_seq(sxNak, seq);
+		return;
+	}
+
+	sysex_send_seq(sxAck, seq);
+}
+
+static void sysex_process(const u8 *b, u8 len) {
+	u16 seq;
+
+	if (len < 4 || b[0] != SYSEX_MANUFACTURER || b[1] != SYSEX_DEVICE ||
+		b[2] != (FIRSTRUN_KEY & 0x7f))
+		return;
+
+	switch (b[3]) {
+		case sxRequest:
+			if (len < 7 || !sysex_target(b[4], b[5], b[6]))
+				break;
+			sysex.state = sxDump;
+			sysex_send_chunk();
+			break;
+		case sxChunk:
+			sysex_chunk(&b[4], len - 4);
+			break;
+		case sxDone:
+			sysex_done(&b[4], len - 4);
 			break;
-		case 64:  // sustain pedal
-			midi_sustain(ch, val);
+		case sxAck:
+		case sxNak:
+			if (sysex.state != sxDump || len < 6)
+				break;
+			seq = b[4] | (b[5] << 7);
+			if (b[3] == sxAck && seq == sysex.seq)
+				sysex.seq++;
+			sysex_send_chunk();
 			break;
 		default:
 			break;
 	}
 }
 
+static void sysex_feed(u8 b) {
+	if (b == 0xf0) {
+		sysex_rx_active = 1;
+		sysex_rx_len = 0;
+	}
+	else if (!sysex_rx_active || b >= 0xf8) {
+		// realtime may interleave, padding after F7 is dropped
+	}
+	else if (b == 0xf7) {
+		sysex_rx_active = 0;
+		sysex_process(sysex_rx, sysex_rx_len);
+	}
+	else if ((b & 0x80) || sysex_rx_len == SYSEX_RX_MAX) {
+		sysex_rx_active = 0;
+	}
+	else
+		sysex_rx[sysex_rx_len++] = b;
+}
+
 
 static void handler_MidiPollADC(s32 data) {
 	u8 i;
 	u16 cv;
 
-	adc_convert(&adc);
+	adc_poll();
 
 	for (i = 0; i < 3; i++) {
-		if (ain[i].hys) {
+		if (pot_changed(i, i == 0 ? 16 : 40)) {
 			switch (i) {
 				case 0:
 					// portamento
-					port_time = ((adc[i] + adc_last[i]) >> 1 >> 4);
+					port_time = (ain[i].v >> 4);
 					aout[3].slew = EXP[port_time];
 					// slew is [0, 256]
 					// print_dbg("\r\nadc 0 / portamento: ");
@@ -2201,23 +4853,19 @@ static void handler_MidiPollADC(s32 data) {
 					break;
 				case 1:
 					// cv is [0, 4096] -- 4038 seems like the max returned from converter
-					cv = ((adc[i] + adc_last[i]) >> 1) / 40;  // [0, ~20]
+					cv = ain[i].v / 40;  // [0, ~20]
 					track_shape = (u8)cv;
 					// print_dbg("\r\ntrack shape: ");
 					// print_dbg_ulong(cv);
 					break;
 				case 2:
-					cv = ((adc[i] + adc_last[i]) >> 1) / 40; // [0, ~20]
+					cv = ain[i].v / 40; // [0, ~20]
 					vel_shape = (u8)cv;
 					// print_dbg("\r\nvel shape: ");
 					// print_dbg_ulong(cv);
 					break;
 			}
 		}
-		else if (abs(((adc[i] + adc_last[i]) >> 1) - ain[i].latch) > POT_HYSTERESIS) {
-			ain[i].hys = 1;
-		}
-		adc_last[i] = adc[i];
 	}
 }
 
@@ -2234,6 +4882,13 @@ static void handler_MidiConnect(s32 data) {
 
 	process_ii = &es_midi_process_ii;
 
+	midi_active = 1;
+	cc_learn = 0;
+	rpn_msb = rpn_lsb = 127;
+	bend_range_set(es.bend_range);
+	sysex.state = sxIdle;
+	sysex_rx_active = 0;
+
 	notes_init(&notes);
 	midi_legato = 1; // FIXME: allow this to be controlled!
 	port_active = 1; // FIXME: allow this to be controlled!
@@ -2244,7 +4899,7 @@ static void handler_MidiConnect(s32 data) {
 	slew_active = 0;
 	aout_clear();
 	aout_write();
-	gpio_clr_gpio_pin(B00);
+	gate_off();
 	slew_active = 1;
 
 	// switch handlers
@@ -2253,7 +4908,8 @@ static void handler_MidiConnect(s32 data) {
 	reset_hys();
 
 	// install timers
-	timer_add(&adcTimer, 27, &adcTimer_callback, NULL);
+	adc_slow = 27;
+	adc_every(adc_slow);
 	timer_add(&midiPollTimer, 13, &midi_poll_timer_callback, NULL);
 }
 
@@ -2261,6 +4917,9 @@ static void handler_MidiDisconnect(s32 data) {
 	// print_dbg("\r\nmidi disconnect: 0x");
 	// print_dbg_hex(data);
 
+	midi_active = 0;
+	cc_learn = 0;
+
 	// remove midi related timers
 	timer_remove(&midiPollTimer);
 	timer_remove(&adcTimer); // remove ours
@@ -2269,7 +4928,7 @@ static void handler_MidiDisconnect(s32 data) {
 	slew_active = 0;
 	aout_clear();
 	aout_write();
-	gpio_clr_gpio_pin(B00);
+	gate_off();
 	slew_active = 1;
 
 	reset_hys();
@@ -2282,7 +4941,7 @@ static void handler_MidiDisconnect(s32 data) {
 	for (u8 i = 0; i < 4; i++)
 		aout[i] = suspend.aout[i];
 
-	process_ii = &es_process_ii;
+	process_ii = &es_ii_receive;
 
 	// FIXME: copied from main()
 	//timer_add(&adcTimer, 5, &adcTimer_callback, NULL); // done by handler_MonomeConnect
@@ -2301,6 +4960,14 @@ static void handler_MidiPacket(s32 raw) {
 
 	// FIXME: ch seems to always be 0?
 
+	// sysex spans packets, hand over raw bytes until the closing F7
+	if (sysex_rx_active || (data >> 24) == 0xf0) {
+		sysex_feed(data >> 24);
+		sysex_feed((data >> 16) & 0xff);
+		sysex_feed((data >> 8) & 0xff);
+		return;
+	}
+
 	// check status byte
   com = (data & 0xf0000000) >> 28;
   ch  = (data & 0x0f000000) >> 24;
@@ -2375,6 +5042,39 @@ static inline void assign_main_event_handlers(void) {
 // app event loop
 void check_events(void) {
 	static event_t e;
+	u8 i;
+
+	// ii has been waiting since its interrupt, take it first. the playheads
+	// are held rather than the timer, so slews, gates and keys keep running
+	// however long the commands take, and each frame lands between two
+	// playhead ticks. clock pulses that came in before the frames are stepped
+	// by the tick first, so they stay in order.
+	if(i2c_rd != i2c_wr && ii_pulse_rd == ii_pulse_wr) {
+		ph_hold = 1;
+		while(i2c_rd != i2c_wr) {
+			if(process_ii == &es_ii_receive) {
+				if(i2c_queue[i2c_rd].l > 3) {
+					for(i=0;i+3<=i2c_queue[i2c_rd].l;i+=3)
+						es_process_ii(&i2c_queue[i2c_rd].data[i], 3);
+				}
+				else
+					es_process_ii(i2c_queue[i2c_rd].data, i2c_queue[i2c_rd].l);
+			}
+			i2c_rd = (i2c_rd + 1) & (I2C_QUEUE - 1);
+		}
+		ph_hold = 0;
+	}
+
+	// work the clock timer found but left for here
+	if(dub_queued)
+		dub_merge();
+
+	if(magic_queued) {
+		i = magic_queued;
+		magic_queued = 0;
+		magic(i);
+	}
+
 	if( event_next(&e) ) {
 		(app_event_handlers)[e.type](e.data);
 	}
@@ -2431,10 +5131,39 @@ void flash_read(void) {
 		}
 	}
 
+	for(i1=0;i1<MIDI_CC_COUNT;i1++)
+		es.cc[i1] = flashy.es[preset_select].cc[i1];
+	bend_range_set(flashy.es[preset_select].bend_range);
+	for(i1=0;i1<4;i1++)
+		es.midi_slew[i1] = flashy.es[preset_select].midi_slew[i1];
+
+	for(i1=0;i1<XF_SLOTS;i1++)
+		for(i2=0;i2<XF_OPS;i2++)
+			es.xf[i1][i2] = flashy.es[preset_select].xf[i1][i2];
+
+	for(i1=0;i1<CHAIN_STEPS;i1++)
+		es.chain[i1] = flashy.es[preset_select].chain[i1];
+	es.sw_div = flashy.es[preset_select].sw_div;
+	slew_cache_all();
+
+	es.tune = flashy.es[preset_select].tune;
+	es.quant = flashy.es[preset_select].quant & 7;
+	es.qscale = flashy.es[preset_select].qscale;
+	tune_check();
+	tune_resolve();
+	for(i1=0;i1<4;i1++)
+		es.curve[i1] = flashy.es[preset_select].curve[i1] < curveCount ?
+			flashy.es[preset_select].curve[i1] : curveLin;
+
 	for(i1=0;i1<16;i1++) {
 		es.p[i1].length = flashy.es[preset_select].p[i1].length;
 		es.p[i1].total_time = flashy.es[preset_select].p[i1].total_time;
 		es.p[i1].loop = flashy.es[preset_select].p[i1].loop;
+		es.p[i1].rate = flashy.es[preset_select].p[i1].rate;
+		es.p[i1].mul = flashy.es[preset_select].p[i1].mul;
+		es.p[i1].div = flashy.es[preset_select].p[i1].div;
+		es.p[i1].groove = flashy.es[preset_select].p[i1].groove;
+		pattern_check(&es.p[i1]);
 		es.p[i1].x = flashy.es[preset_select].p[i1].x;
 		es.p[i1].y = flashy.es[preset_select].p[i1].y;
 
@@ -2445,6 +5174,10 @@ void flash_read(void) {
 			es.p[i1].e[i2].interval = flashy.es[preset_select].p[i1].e[i2].interval;
 		}
 	}
+
+	// history belongs to the patterns just replaced
+	undo_clear();
+	seek_valid = 0;
 }
 
 
@@ -2479,6 +5212,8 @@ int main(void)
 
 	init_i2c_slave(0x50);
 
+	gate_init();
+
 
 	print_dbg("\r\n\n// earthsea! //////////////////////////////// ");
 	print_dbg_ulong(sizeof(flashy));
@@ -2491,13 +5226,15 @@ int main(void)
 
 	r_status = rOff;
 
-	gpio_clr_gpio_pin(B00);
+	gate_off();
 
 	monomeFrameDirty++;
 
 
 	u8 i1, i2;
 
+	cal_read();
+
 	if(flash_is_fresh()) {
 		print_dbg("\r\nfirst run.");
 		flash_unfresh();
@@ -2524,7 +5261,54 @@ int main(void)
 			es.p[i1].length = 0;
 			es.p[i1].total_time = 0;
 			es.p[i1].loop = 0;
+			es.p[i1].rate = RATE_UNITY;
+			es.p[i1].mul = 1;
+			es.p[i1].div = 1;
+			es.p[i1].groove = 0;
+		}
+
+		for(i1=0;i1<MIDI_CC_COUNT;i1++) {
+			es.cc[i1].dest = ccOff;
+			es.cc[i1].curve = ccLinear;
+			es.cc[i1].smooth = 0;
+		}
+		// mod wheel to cv a with a touch of smoothing, sustain pedal
+		es.cc[1].dest = ccA0;
+		es.cc[1].smooth = 2;
+		es.cc[64].dest = ccSustain;
+
+		es.bend_range = MIDI_BEND_RANGE;
+		for(i1=0;i1<3;i1++)
+			es.midi_slew[i1] = 0;
+		es.midi_slew[3] = MIDI_BEND_SLEW;
+
+		// transform chains: linearize (also the magic shape), reverse,
+		// quantize to 6 ticks, thin to every other event
+		for(i1=0;i1<XF_SLOTS;i1++)
+			for(i2=0;i2<XF_OPS;i2++)
+				es.xf[i1][i2].op = xfEnd;
+		es.xf[0][0].op = xfLinear;
+		es.xf[1][0].op = xfReverse;
+		es.xf[2][0].op = xfQuantize;
+		es.xf[2][0].arg = 6;
+		es.xf[3][0].op = xfThin;
+		es.xf[3][0].arg = 2;
+
+		// switch on the loop point, empty chain
+		for(i1=0;i1<CHAIN_STEPS;i1++) {
+			es.chain[i1].pattern = 0;
+			es.chain[i1].repeats = 0;
 		}
+		es.sw_div = 1;
+
+		for(i1=0;i1<4;i1++)
+			es.curve[i1] = curveLin;
+		slew_cache_all();
+
+		tune_default();
+		es.quant = 0;
+		es.qscale = 0;
+		tune_resolve();
 
 		// save all presets, clear glyphs
 		for(i1=0;i1<8;i1++) {
@@ -2556,14 +5340,16 @@ int main(void)
 
 	re = &refresh;
 
-	process_ii = &es_process_ii;
+	process_ii = &es_ii_receive;
+
+	ph_init();
 
 	clock_pulse = &clock;
-	// clock_external = !gpio_get_pin_value(B09);
+	ext_jack = !gpio_get_pin_value(B09);
 
 	// setup daisy chain for two dacs
 	spi_selectChip(SPI,DAC_SPI_NPCS);
-	spi_write(SPI,0x80);
+	spi_write(SPI,DAC_NOOP);
 	spi_write(SPI,0xff);
 	spi_write(SPI,0xff);
 	spi_unselectChip(SPI,DAC_SPI_NPCS);
@@ -2572,7 +5358,7 @@ int main(void)
 	slew_active = 1;
 
 	timer_add(&clockTimer,10,&clockTimer_callback, NULL);
-	timer_add(&cvTimer,5,&cvTimer_callback, NULL);
+	timer_add(&cvTimer,CV_MS,&cvTimer_callback, NULL);
 	timer_add(&keyTimer,51,&keyTimer_callback, NULL);
 	// adc timer is added inside the monome connect handler
 	// timer_add(&adcTimer,61,&adcTimer_callback, NULL);
@@ -0,0 +1,78 @@
+// the pot filter against noisy pot traces: a resting pot reports nothing and
+// polls slowly, slow and fast turns are followed closely, and spikes are
+// dropped
+
+#include "../src/main.c"
+#include "test.h"
+
+// a pot at v with +-4 counts of noise and a spike every so often
+static u16 pot(s32 v, u32 n) {
+	v += rand() % 9 - 4;
+	if (n % 53 == 0)
+		v += n & 64 ? 400 : -400;
+	return v < 0 ? 0 : v > 4095 ? 4095 : v;
+}
+
+// poll a trace going from a to b over ms, then resting for rest ms, at
+// whatever rate the filter asks for. returns the furthest the filtered value
+// got from the pot while it moved and counts what was reported.
+static u32 now, reports;
+
+static s32 trace(s32 a, s32 b, u32 ms, u32 rest) {
+	u32 t = now + ms, end = t + rest;
+	s32 at, err, worst = 0;
+
+	while (now < end) {
+		now += adc_ms;
+		at = now < t ? a + (b - a) * (s32)(ms - (t - now)) / (s32)ms : b;
+		host_adc[0] = pot(at, now);
+		adc_poll();
+		if (pot_changed(0, ADC_NOISE))
+			reports++;
+
+		err = abs((s32)ain[0].v - at);
+		if (now < t && err > worst)
+			worst = err;
+	}
+
+	return worst;
+}
+
+int main(void) {
+	s32 lag;
+
+	srand(7);
+	adc_every(adc_slow);
+	host_adc[0] = 2000;
+	adc_poll();
+	ain[0].hys = 1;
+
+	// resting: nothing reported, polled slowly, close to where it is
+	reports = 0;
+	trace(2000, 2000, 1, 5000);
+	CHECK(reports == 0);
+	CHECK(adc_ms == adc_slow && adcTimer.ticks == adc_slow);
+	CHECK(abs((s32)ain[0].v - 2000) <= 2);
+
+	// a slow turn, a few counts a poll
+	reports = 0;
+	lag = trace(2000, 2400, 6000, 1000);
+	printf("adc: slow turn %d counts behind at worst\n", lag);
+	CHECK(lag <= 16);
+	CHECK(reports > 20);
+	CHECK(abs((s32)ain[0].v - 2400) <= 2);
+
+	// a fast one is behind by no more than it moves in one slow poll
+	lag = trace(2400, 300, 300, 2000);
+	printf("adc: fast turn %d counts behind at worst\n", lag);
+	CHECK(lag <= 2100 * 61 / 300);
+	CHECK(abs((s32)ain[0].v - 300) <= 2);
+
+	// and back at rest it slows down again
+	reports = 0;
+	trace(300, 300, 1, 3000);
+	CHECK(reports == 0);
+	CHECK(adc_ms == adc_slow && adcTimer.ticks == adc_slow);
+
+	return host_done("adc");
+}
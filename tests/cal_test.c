@@ -0,0 +1,70 @@
+// dac calibration: the default is the identity, an offset and gain move the
+// codes along a straight line, and nothing goes past either end of the dac
+
+#include "../src/main.c"
+#include "test.h"
+
+// send output 0 at v and return the code that went out: only its frame
+// moves, and it's the second word of that frame
+static u16 send0(u16 v) {
+	u32 at = host_spi_len;
+
+	aout[0].now = v;
+	aout_write();
+	CHECK(host_spi_len == at + 6);
+	return (host_spi_log[at + 4] << 4) | (host_spi_log[at + 5] >> 4);
+}
+
+int main(void) {
+	s32 want;
+	u16 v;
+	u8 c;
+
+	VARI = 1;
+	for (c = 0; c < 4; c++) {
+		cal.ofs[c] = cal.gain[c] = 0;
+		cal_reset(c);
+	}
+
+	// identity
+	for (c = 0; c < 4; c++)
+		for (v = 0; v < 4096; v++)
+			CHECK(cal_code(c, v) == v);
+
+	// +10 codes and +1% on output 1: within a code of the line, clamped at
+	// the top
+	cal.ofs[1] = 10;
+	cal.gain[1] = 41;
+	cal_reset(1);
+	for (v = 0; v < 4096; v++) {
+		want = ((s32)v * (4096 + 41) >> 12) + 10;
+		if (want > 4095)
+			want = 4095;
+		CHECK(abs(cal_code(1, v) - want) <= 1);
+	}
+	CHECK(cal_code(1, 4095) == 4095);
+	CHECK(cal_code(1, 5000) == 4095);
+
+	// -10 codes and -1% on output 2 stop at 0 and never reach 4095
+	cal.ofs[2] = -10;
+	cal.gain[2] = -41;
+	cal_reset(2);
+	for (v = 0; v < 4096; v++) {
+		want = ((s32)v * (4096 - 41) >> 12) - 10;
+		if (want < 0)
+			want = 0;
+		CHECK(abs(cal_code(2, v) - want) <= 1);
+	}
+	CHECK(cal_code(2, 0) == 0);
+	CHECK(cal_code(2, 4095) < 4095);
+
+	// and the dac gets the corrected code
+	cal.ofs[0] = 20;
+	cal.gain[0] = 0;
+	cal_reset(0);
+	aout_write();
+	CHECK(send0(1000) == 1020);
+	CHECK(send0(4095) == 4095);
+
+	return host_done("cal");
+}
@@ -0,0 +1,147 @@
+// the external clock estimator against a jittery pulse train: tempo within a
+// few percent, glitches dropped, tempo changes taken within two pulses,
+// and an ext clocked loop that stays on every ext_ppl-th pulse
+
+#include "../src/main.c"
+#include "test.h"
+
+#define MS(x) ((u64)(x) * 1000000)
+#define CYCLES(ns) ((u32)((ns) * (FMCK_HZ / 1000000) / 1000))
+
+static u32 jitter(u32 period, u8 pct) {
+	s32 j = (s32)(period * pct / 100);
+	return period + (rand() % (2 * j + 1)) - j;
+}
+
+static int near(u32 a, u32 b, u8 pct) {
+	return abs((s32)(a - b)) <= (s32)(b / 100 * pct);
+}
+
+static void estimator(void) {
+	clk_est_t k;
+	u32 t = 12345, p = CYCLES(MS(250)), n, i;
+
+	memset(&k, 0, sizeof(k));
+
+	// 1000 pulses at 250ms +-5%: every pulse counted, tempo within 3%
+	for (i = 0; i < 1000; i++) {
+		t += jitter(p, 5);
+		ext_pulse(&k, t);
+		if (i > 20)
+			CHECK(near(k.period, p, 3));
+	}
+	CHECK(k.n == 1000);
+
+	// a glitch a third of the way into a period is dropped
+	n = k.n;
+	ext_pulse(&k, t + p / 3);
+	t += p;
+	ext_pulse(&k, t);
+	CHECK(k.n == n + 1);
+	CHECK(near(k.period, p, 2));
+
+	// a new tempo is taken on the second pulse that agrees with it
+	p = CYCLES(MS(180));
+	for (i = 0; i < 2; i++) {
+		t += jitter(p, 2);
+		ext_pulse(&k, t);
+	}
+	CHECK(near(k.period, p, 4));
+	for (i = 0; i < 50; i++) {
+		t += jitter(p, 5);
+		ext_pulse(&k, t);
+	}
+	CHECK(near(k.period, p, 2));
+
+	// a long stop measures again from scratch
+	t += 10 * p;
+	ext_pulse(&k, t);
+	CHECK(k.lock == 1);
+	p = CYCLES(MS(400));
+	t += p;
+	ext_pulse(&k, t);
+	CHECK(k.lock == 2 && k.period == p);
+}
+
+// a 160 tick pattern on the jack clock at 16 pulses a loop. once locked each
+// loop has to start within a tenth of a pulse of every 16th pulse on the grid
+// the jittered pulses sit around.
+static u64 pulse_at[8192], grid_at[8192], loop_at[512];
+
+static void follow(void) {
+	pattern_t *p = &es.p[1];
+	u64 next_pulse, grid;
+	u32 period = 230, pulses = 0, loops = 0, at = 0, m;
+	s64 err, worst = 0, sum = 0;
+	u8 i, was = 0;
+
+	memset(p, 0, sizeof(*p));
+	p->length = 4;
+	for (i = 0; i < 4; i++)
+		p->e[i].interval = 40;
+	p->total_time = 160;
+	p->loop = 1;
+	p->rate = RATE_UNITY;
+	pattern_check(p);
+
+	timer_add(&clockTimer, 10, &clockTimer_callback, NULL);
+	ext_jack = 1;
+	ext_ppl = 16;
+	host_ns = 0;
+	grid = MS(5);
+	next_pulse = grid;
+
+	ph_play(0, 1);
+	ph_clock(0, phClockExt);
+
+	while (loops < 300) {
+		host_ns += MS(10);
+
+		while (next_pulse <= host_ns) {
+			u64 now = host_ns;
+			host_ns = next_pulse;
+			clock(1);
+			host_ns = now;
+			pulse_at[pulses] = next_pulse;
+			grid_at[pulses++] = grid;
+			// +-5% around a steady grid
+			grid += MS(period);
+			next_pulse = grid + MS(jitter(period, 5)) - MS(period);
+		}
+
+		clockTimer_callback(NULL);
+
+		if (ph[0].pos < was)
+			loop_at[loops++] = host_ns;
+		was = ph[0].pos;
+	}
+
+	// a loop can start just ahead of its pulse, so match them up afterwards:
+	// take the pulse nearest loop 50, then every 16th one from there
+	while (at + 1 < pulses && pulse_at[at + 1] + pulse_at[at] < 2 * loop_at[50])
+		at++;
+	for (m = 51; m < loops && at + 16 < pulses; m++) {
+		at += 16;
+		err = (s64)loop_at[m] - (s64)grid_at[at];
+		if (err < 0)
+			err = -err;
+		sum += err;
+		if (err > worst)
+			worst = err;
+	}
+
+	printf("clock: loop starts %lld ms from their grid pulse on average, %lld at worst (pulse %u ms, tick 10 ms)\n",
+		(long long)(sum / (m - 51) / 1000000), (long long)(worst / 1000000), period);
+	CHECK(worst <= (s64)MS(period) / 10);
+}
+
+int main(void) {
+	srand(3);
+	VARI = 1;
+	ph_init();
+
+	estimator();
+	follow();
+
+	return host_done("clock");
+}
@@ -0,0 +1,96 @@
+// 10,000 loops of a pattern through the clock timer, at rates that don't
+// divide the intervals, with the tick counter wrapping part way. every event
+// has to land on exactly the tick its place in the pattern says. with wobble
+// set the rate is changed and put back every few ticks, which mustn't move
+// anything either. the rate change holds the timer off while it rescales,
+// which is what keeps a tick from landing half way through one.
+
+#include "../src/main.c"
+#include "test.h"
+
+#define LOOPS 10000
+
+static const u8 INTERVAL[] = { 7, 13, 0, 29, 1 };
+#define LEN sizeof(INTERVAL)
+#define TOTAL 50
+
+static void run(u16 rate, u8 wobble) {
+	pattern_t *p = &es.p[3];
+	u64 s = 0, m = 0, fired = 0;
+	u32 start, due, tick, sections;
+	u8 i, pos, was;
+
+	memset(p, 0, sizeof(*p));
+	for (i = 0; i < LEN; i++) {
+		p->e[i].shape = 0;
+		p->e[i].interval = INTERVAL[i];
+	}
+	p->length = LEN;
+	p->total_time = TOTAL;
+	p->loop = 1;
+	p->rate = rate;
+	pattern_check(p);
+
+	ph_tick = 0xffffffff - 1000;
+	ph_play(0, 3);
+	start = ph_tick + 1;
+	due = start;
+	was = 0;
+
+	while (m < (u64)LOOPS * LEN) {
+		clockTimer_callback(NULL);
+		tick = ph_tick;
+
+		if (wobble && tick % 37 == 0) {
+			sections = host_irq_sections[APP_TC_IRQ_PRIORITY];
+			pattern_rate(3, rate * 3 / 2 + 1);
+			pattern_rate(3, rate);
+			CHECK(host_irq_sections[APP_TC_IRQ_PRIORITY] == sections + 2);
+			CHECK(!host_irq_masked[APP_TC_IRQ_PRIORITY]);
+
+			// from inside a masked section it leaves the mask alone
+			host_irq_masked[APP_TC_IRQ_PRIORITY] = 1;
+			pattern_rate(3, rate);
+			CHECK(host_irq_masked[APP_TC_IRQ_PRIORITY]);
+			host_irq_masked[APP_TC_IRQ_PRIORITY] = 0;
+		}
+
+		// events the engine ran this tick
+		pos = ph[0].pos;
+		fired += pos >= was ? pos - was : pos + LEN - was;
+		was = pos;
+
+		// events that should have run by now
+		while ((s32)(tick - due) >= 0) {
+			s += INTERVAL[m % LEN];
+			m++;
+			due = start + (u32)((s << 8) / rate);
+		}
+
+		if (fired != m) {
+			printf("rate %u: tick %u has %llu events, wants %llu\n",
+				rate, tick - start, (unsigned long long)fired, (unsigned long long)m);
+			host_failed++;
+			return;
+		}
+	}
+
+	// the last loop ended on the exact tick, nothing gained or lost
+	CHECK(due - start == (u32)(((u64)LOOPS * TOTAL << 8) / rate));
+	ph_stop(0);
+}
+
+int main(void) {
+	VARI = 1;
+	ph_init();
+
+	run(RATE_UNITY, 0);
+	run(97, 0);
+	run(300, 0);
+	run(RATE_MIN, 0);
+	run(511, 0);
+	run(97, 1);
+	run(300, 1);
+
+	return host_done("drift");
+}
@@ -0,0 +1,156 @@
+// overdubs merged part way through a loop play at their own time in that
+// same loop, and the events around them stay on their ticks. a full pattern's
+// merge holds the clock timer off for well under one tick.
+
+#include "../src/main.c"
+#include "test.h"
+
+static u32 start;
+
+// tick each event of pattern 2 fires on, for one pass of the loop
+static void run(u16 rate, u16 dub_at, u16 merge_at, u32 *fired) {
+	pattern_t *p = &es.p[2];
+	u32 tick;
+	u8 i, was = 0;
+
+	memset(p, 0, sizeof(*p));
+	p->length = 3;
+	p->e[0].interval = 40;
+	p->e[1].interval = 60;
+	p->e[2].interval = 100;
+	for (i = 0; i < 3; i++)
+		p->e[i].x = i;
+	p->total_time = 200;
+	p->loop = 1;
+	p->rate = rate;
+
+	dub_rd = dub_wr = 0;
+	ph_tick = 1000;
+	ph_play(0, 2);
+	start = ph_tick + 1;
+	dub_pattern = 2;
+
+	for (tick = 0; tick < (u32)200 * 256 / rate; tick++) {
+		clockTimer_callback(NULL);
+
+		if (ph_tick - start == merge_at) {
+			dub[0].shape = 1;
+			dub[0].x = 9;
+			dub[0].t = dub_at;
+			dub_wr = 1;
+			dub_queued = 1;
+			check_events();
+		}
+
+		while (was < ph[0].pos)
+			fired[was++] = ph_tick - start;
+	}
+
+	ph_stop(0);
+}
+
+// shortest clock tick (midi mode), in cycles
+#define TICK_CYCLES (6 * (FMCK_HZ / 1000))
+// how much slower than the host the device is taken to be, generously: a
+// 60 MHz avr32 against one host core
+#define HOST_FASTER 1000
+#define FULL (EVENTS_PER_PATTERN - 4)
+
+// 4 overdubs stamped ahead of all but the first event of a 124 event pattern, with all
+// four playheads on it, so the merge moves every event and refits each one.
+// returns the cycles the merge held the timer off for.
+static u32 full(void) {
+	pattern_t *p = &es.p[2];
+	u32 sum;
+	u8 i;
+
+	memset(p, 0, sizeof(*p));
+	p->length = FULL;
+	for (i = 0; i < FULL; i++) {
+		p->e[i].interval = 1;
+		p->e[i].x = i & 15;
+	}
+	p->e[FULL - 1].interval = 200 - (FULL - 1);
+	p->total_time = 200;
+	p->loop = 1;
+	p->rate = RATE_UNITY;
+
+	dub_rd = dub_wr = 0;
+	dub_saved = 0;
+	ph_tick = 1000;
+	for (i = 0; i < PLAYHEADS; i++)
+		ph_play(i, 2);
+	dub_pattern = 2;
+
+	for (i = 0; i < 4; i++) {
+		dub[i].shape = 1;
+		dub[i].x = 9;
+		dub[i].y = i;
+		dub[i].t = 0;
+	}
+	dub_wr = 4;
+	dub_queued = 1;
+	dub_cycles = 0;
+	check_events();
+
+	CHECK(p->length == EVENTS_PER_PATTERN);
+	for (i = 0, sum = 0; i < p->length; i++)
+		sum += p->e[i].interval;
+	CHECK(sum == p->total_time);
+	// the first event is on 0 too and stays first
+	CHECK(p->e[0].x == 0);
+	for (i = 0; i < 4; i++)
+		CHECK(p->e[i + 1].x == 9 && p->e[i + 1].y == i);
+	CHECK(p->e[5].x == 1 && p->e[EVENTS_PER_PATTERN - 1].x == ((FULL - 1) & 15));
+
+	for (i = 0; i < PLAYHEADS; i++)
+		ph_stop(i);
+	return dub_cycles;
+}
+
+int main(void) {
+	u32 fired[8];
+	u32 c, best;
+	u8 i;
+
+	VARI = 1;
+	ph_init();
+
+	// dub at 70 merged at 50: 0, 40, 70, 100
+	run(RATE_UNITY, 70, 50, fired);
+	CHECK(es.p[2].length == 4);
+	CHECK(es.p[2].e[2].x == 9);
+	CHECK(fired[0] == 0 && fired[1] == 40 && fired[2] == 70 && fired[3] == 100);
+
+	// the same at a rate that leaves a remainder
+	run(97, 70, 50, fired);
+	CHECK(fired[1] == 40 * 256 / 97);
+	CHECK(fired[2] == 70 * 256 / 97);
+	CHECK(fired[3] == 100 * 256 / 97);
+
+	// a dub stamped before the merge point waits for the next loop: the
+	// playhead steps over it at the merge and goes on to 100
+	run(RATE_UNITY, 20, 50, fired);
+	CHECK(es.p[2].e[1].x == 9);
+	CHECK(fired[2] == 50 && fired[3] == 100);
+
+	// after the last event it still comes before the loop point
+	run(RATE_UNITY, 150, 120, fired);
+	CHECK(fired[3] == 150);
+
+	// a full pattern, timed on the host's own clock. the best of a few runs,
+	// so the host being busy elsewhere doesn't count.
+	host_real_clock = 1;
+	best = 0xffffffff;
+	for (i = 0; i < 50; i++) {
+		c = full();
+		if (c < best)
+			best = c;
+	}
+	host_real_clock = 0;
+	printf("dub: %u+4 event merge held the timer off %u cycles on the host, a tick is %u\n",
+		FULL, best, TICK_CYCLES);
+	CHECK((u64)best * HOST_FASTER < TICK_CYCLES);
+
+	return host_done("dub");
+}
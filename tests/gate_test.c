@@ -0,0 +1,129 @@
+// gate edges off the tc channel, by timestamp: fixed pulses are exact to a
+// count, a retrigger drops for the gap and then runs the full length, and
+// anything that takes the gate over (midi notes, sustain, mode switches)
+// cancels a pulse in flight so it can't drop the gate later. nothing unmasks
+// the gate level it didn't mask itself.
+
+#include "../src/main.c"
+#include "test.h"
+
+#define US(x) ((u64)(x) * 1000)
+// one count of the gate channel
+#define COUNT_NS (32 * 1000000000ull / FPBA_HZ + 1)
+
+static int near(u64 a, u64 b) {
+	return (a > b ? a - b : b - a) <= COUNT_NS;
+}
+
+static u32 len_us(void) {
+	return ((EXP[es.edge_fixed_time] >> 2) + 1) * GATE_UNIT_US;
+}
+
+static void reset(void) {
+	gate_off();
+	host_edges = 0;
+	host_ns = US(1000);
+}
+
+int main(void) {
+	u64 t;
+	u32 us;
+	u16 i;
+
+	VARI = 1;
+	gate_init();
+	es.edge = eFixed;
+	es.edge_fixed_time = 10;
+
+	// one pulse: up now, down exactly its length later, nothing after
+	reset();
+	t = host_ns;
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() * 2));
+	CHECK(host_edges == 2);
+	CHECK(host_edge[0].level == 1 && host_edge[0].ns == t);
+	CHECK(host_edge[1].level == 0 && near(host_edge[1].ns, t + US(len_us())));
+	CHECK(!edge_state);
+
+	// a long one, past one compare period of the 16 bit counter
+	es.edge_fixed_time = 120;
+	reset();
+	t = host_ns;
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() + 1000));
+	CHECK(host_edges == 2);
+	CHECK(near(host_edge[1].ns, t + US(len_us())));
+	es.edge_fixed_time = 10;
+
+	// retriggered half way: down now, up after the gap, then the full length
+	reset();
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() / 2));
+	t = host_ns;
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() * 2));
+	CHECK(host_edges == 4);
+	CHECK(host_edge[1].level == 0 && host_edge[1].ns == t);
+	CHECK(host_edge[2].level == 1 && near(host_edge[2].ns, t + US(GATE_GAP_US)));
+	CHECK(host_edge[3].level == 0 &&
+		near(host_edge[3].ns, host_edge[2].ns + US(len_us())));
+
+	// a midi note over a pattern's pulse holds the gate past the pulse's end
+	reset();
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() / 2));
+	midi_note_on(0, 60, 100);
+	host_tc_run(US(len_us() * 2));
+	CHECK(host_edges == 1);
+	CHECK(host_pin[B00] && edge_state);
+
+	// sustain let go drops it, and for good
+	midi_sustain(0, 0);
+	host_tc_run(US(len_us() * 2));
+	CHECK(host_edges == 2 && !host_pin[B00] && !edge_state);
+
+	// switching to midi part way through a pulse
+	reset();
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() / 2));
+	t = host_ns;
+	handler_MidiConnect(0);
+	host_tc_run(US(len_us() * 2));
+	CHECK(host_edges == 2);
+	CHECK(host_edge[1].level == 0 && host_edge[1].ns == t);
+
+	// and back
+	reset();
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() / 2));
+	midi_note_on(0, 60, 100);
+	note_gate(1, 3, 3);
+	host_tc_run(US(len_us() / 4));
+	t = host_ns;
+	handler_MidiDisconnect(0);
+	host_tc_run(US(len_us() * 2));
+	CHECK(!host_pin[B00]);
+	CHECK(host_edge[host_edges - 1].level == 0 && host_edge[host_edges - 1].ns == t);
+
+	// from the clock timer, or anything else with the gate level already
+	// masked, it's left masked
+	reset();
+	host_irq_masked[GATE_TC_IRQ_PRIORITY] = 1;
+	note_gate(1, 3, 3);
+	CHECK(host_irq_masked[GATE_TC_IRQ_PRIORITY]);
+	gate_off();
+	CHECK(host_irq_masked[GATE_TC_IRQ_PRIORITY]);
+	host_irq_masked[GATE_TC_IRQ_PRIORITY] = 0;
+	note_gate(1, 3, 3);
+	CHECK(!host_irq_masked[GATE_TC_IRQ_PRIORITY]);
+	gate_off();
+
+	// the 32 bit count is exact for every fixed edge
+	for (i = 0; i < 256; i++) {
+		us = ((EXP[i] >> 2) + 1) * GATE_UNIT_US;
+		CHECK(gate_counts(us) == (u64)us * GATE_HZ / 1000000);
+	}
+	CHECK(gate_counts(GATE_GAP_US) == (u64)GATE_GAP_US * GATE_HZ / 1000000);
+
+	return host_done("gate");
+}
@@ -0,0 +1,287 @@
+// mocks for the libavr32/asf calls main.c makes, see host.h
+
+#include <time.h>
+
+#include "host.h"
+
+int host_failed;
+u64 host_ns;
+u8 host_real_clock;
+
+////////////////////////////////////////////////////////////////////////////////
+// events and timers, the tests call handlers and callbacks directly
+
+void (*app_event_handlers[kNumEventTypes])(s32);
+
+bool event_post(event_t *e) { return true; }
+bool event_next(event_t *e) { return false; }
+void init_events(void) { }
+
+bool timer_add(softTimer_t *t, u32 ticks, timer_callback_t callback, void *caller) {
+	t->ticks = t->ticksRemain = ticks;
+	t->callback = callback;
+	t->caller = caller;
+	return true;
+}
+
+bool timer_remove(softTimer_t *t) { return true; }
+
+////////////////////////////////////////////////////////////////////////////////
+// monome
+
+u8 monomeFrameDirty;
+u8 monomeLedBuffer[256];
+
+static void refresh_none(void) { }
+void (*monome_refresh)(void) = &refresh_none;
+
+void monome_grid_key_parse_event_data(s32 data, u8 *x, u8 *y, u8 *z) {
+	*x = data & 0xff;
+	*y = (data >> 8) & 0xff;
+	*z = (data >> 16) & 0xff;
+}
+
+u8 monome_size_x(void) { return 16; }
+u8 monome_is_vari(void) { return 1; }
+void monome_set_quadrant_flag(u8 q) { }
+void monome_read_serial(void) { }
+void init_monome(void) { }
+
+////////////////////////////////////////////////////////////////////////////////
+// adc, spi, gpio
+
+u16 host_adc[4];
+
+void adc_convert(u16 (*dst)[4]) {
+	memcpy(*dst, host_adc, sizeof(host_adc));
+}
+
+avr32_spi_t host_spi;
+u32 host_spi_frames, host_spi_torn;
+u8 host_spi_sel;
+u16 host_spi_log[HOST_SPI_MAX];
+u32 host_spi_len;
+void (*host_spi_hook)(void);
+
+int spi_selectChip(volatile avr32_spi_t *spi, u8 chip) {
+	if (host_spi_sel)
+		host_spi_torn++;
+	host_spi_sel++;
+	return 0;
+}
+
+int spi_unselectChip(volatile avr32_spi_t *spi, u8 chip) {
+	host_spi_sel--;
+	host_spi_frames++;
+	return 0;
+}
+
+int spi_write(volatile avr32_spi_t *spi, u16 data) {
+	if (host_spi_len < HOST_SPI_MAX)
+		host_spi_log[host_spi_len++] = data;
+	if (host_spi_hook)
+		host_spi_hook();
+	return 0;
+}
+
+host_edge_t host_edge[HOST_EDGES];
+u32 host_edges;
+u8 host_pin[32];
+
+static void pin_to(u32 pin, u8 level) {
+	if (host_pin[pin] != level && host_edges < HOST_EDGES) {
+		host_edge[host_edges].ns = host_ns;
+		host_edge[host_edges].pin = pin;
+		host_edge[host_edges].level = level;
+		host_edges++;
+	}
+	host_pin[pin] = level;
+}
+
+void gpio_set_gpio_pin(u32 pin) { pin_to(pin, 1); }
+void gpio_clr_gpio_pin(u32 pin) { pin_to(pin, 0); }
+int gpio_get_pin_value(u32 pin) { return host_pin[pin]; }
+
+////////////////////////////////////////////////////////////////////////////////
+// flash is plain memory on the host
+
+u32 host_flash_writes;
+
+void *flashc_memcpy(volatile void *dst, const void *src, size_t n, bool erase) {
+	host_flash_writes++;
+	memmove((void *)dst, src, n);
+	return (void *)dst;
+}
+
+volatile void *flashc_memset8(volatile void *dst, u8 v, size_t n, bool erase) {
+	host_flash_writes++;
+	memset((void *)dst, v, n);
+	return dst;
+}
+
+volatile void *flashc_memset32(volatile void *dst, u32 v, size_t n, bool erase) {
+	u8 *d = (u8 *)dst;
+	size_t i;
+
+	host_flash_writes++;
+	for (i = 0; i < n; i++)
+		d[i] = v >> (8 * (3 - (i & 3)));
+	return dst;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// one tc channel, counting pba / 32 while started
+
+avr32_tc_t host_tc;
+
+static __int_handler tc_handler;
+static u8 tc_running;
+static u16 tc_rc;
+static u64 tc_at;	// ns the counter next reaches rc
+
+#define TC_NS(counts) (((u64)(counts) * 32 * 1000000000ull) / FPBA_HZ)
+
+int tc_init_waveform(volatile avr32_tc_t *tc, const tc_waveform_opt_t *opt) { return 0; }
+int tc_configure_interrupts(volatile avr32_tc_t *tc, unsigned int channel, const tc_interrupt_t *irq) { return 0; }
+
+int tc_write_rc(volatile avr32_tc_t *tc, unsigned int channel, unsigned short v) {
+	// a new rc inside the handler applies to the period that just started
+	tc_rc = v;
+	return 0;
+}
+
+int tc_start(volatile avr32_tc_t *tc, unsigned int channel) {
+	tc_running = 1;
+	tc_at = host_ns + TC_NS(tc_rc);
+	return 0;
+}
+
+int tc_stop(volatile avr32_tc_t *tc, unsigned int channel) {
+	tc_running = 0;
+	return 0;
+}
+
+int tc_read_sr(volatile avr32_tc_t *tc, unsigned int channel) { return 0; }
+
+void host_tc_run(u64 ns) {
+	u64 end = host_ns + ns;
+
+	while (tc_running && tc_at <= end) {
+		host_ns = tc_at;
+		if (tc_handler)
+			tc_handler();
+		// the counter restarted at the compare, so the next one is rc on
+		// from here with whatever rc the handler left
+		if (tc_running && tc_at <= host_ns)
+			tc_at = host_ns + TC_NS(tc_rc);
+	}
+	host_ns = end;
+}
+
+void INTC_register_interrupt(__int_handler handler, u32 irq, u32 level) {
+	tc_handler = handler;
+}
+
+u8 host_irq_masked[4];
+u32 host_irq_sections[4];
+
+void irq_initialize_vectors(void) { }
+void register_interrupts(void) { }
+void cpu_irq_enable(void) { }
+void cpu_irq_disable(void) { }
+
+void cpu_irq_disable_level(int level) {
+	host_irq_masked[level] = 1;
+	host_irq_sections[level]++;
+}
+
+void cpu_irq_enable_level(int level) {
+	host_irq_masked[level] = 0;
+}
+
+int cpu_irq_level_is_enabled(int level) {
+	return !host_irq_masked[level];
+}
+
+u32 Get_sys_count(void) {
+	struct timespec t;
+
+	if (host_real_clock) {
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return (u32)(((u64)t.tv_sec * 1000000000ull + t.tv_nsec) * (FMCK_HZ / 1000000) / 1000);
+	}
+	return (u32)((host_ns * (FMCK_HZ / 1000000)) / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// usb, ii, init
+
+u8 host_midi[HOST_MIDI_MAX];
+u32 host_midi_len;
+
+void midi_read(void) { }
+
+bool midi_write(const u8 *data, u32 bytes) {
+	while (bytes-- && host_midi_len < HOST_MIDI_MAX)
+		host_midi[host_midi_len++] = *data++;
+	return true;
+}
+
+void ftdi_read(void) { }
+void ftdi_setup(void) { }
+u8 host_ii_tx[HOST_II_TX_MAX];
+u32 host_ii_tx_len;
+
+void ii_tx_queue(u8 data) {
+	if (host_ii_tx_len < HOST_II_TX_MAX)
+		host_ii_tx[host_ii_tx_len++] = data;
+}
+
+void (*process_ii)(u8 *data, u8 l);
+void (*clock_pulse)(u8 phase);
+void init_dbg_rs232(u32 hz) { }
+void init_gpio(void) { }
+void init_tc(void) { }
+void init_spi(void) { }
+void init_adc(void) { }
+void init_usb_host(void) { }
+void init_i2c_slave(u8 addr) { }
+void sysclk_init(void) { }
+
+////////////////////////////////////////////////////////////////////////////////
+// held notes, last priority only
+
+void notes_init(note_pool_t *pool) {
+	pool->count = 0;
+}
+
+void notes_release(note_pool_t *pool, u8 num) {
+	u8 i;
+
+	for (i = 0; i < pool->count; i++)
+		if (pool->note[i].num == num) {
+			memmove(&pool->note[i], &pool->note[i + 1],
+				(pool->count - i - 1) * sizeof(held_note_t));
+			pool->count--;
+			return;
+		}
+}
+
+void notes_hold(note_pool_t *pool, u8 num, u8 vel) {
+	notes_release(pool, num);
+	if (pool->count == 16)
+		notes_release(pool, pool->note[0].num);
+	pool->note[pool->count].num = num;
+	pool->note[pool->count].vel = vel;
+	pool->count++;
+}
+
+const held_note_t *notes_get(note_pool_t *pool, note_priority_t p) {
+	if (!pool->count)
+		return NULL;
+	return p == kNotePriorityLast ? &pool->note[pool->count - 1] : &pool->note[0];
+}
+
+void print_dbg(const char *s) { }
+void print_dbg_ulong(unsigned long n) { }
+void print_dbg_hex(unsigned long n) { }
@@ -0,0 +1,249 @@
+// host build of src/main.c
+//
+// every libavr32/asf header main.c pulls in is an empty file under stubs/
+// (the makefile makes them), this is force-included in their place. it has
+// just enough of those apis for main.c to compile, plus the hooks the tests
+// use to drive the mocks in host.c.
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#define FMCK_HZ 60000000
+#define FPBA_HZ 60000000
+#define APP_TC_IRQ_PRIORITY 0
+
+#define B00 0
+#define B01 1
+#define B02 2
+#define B03 3
+#define B08 8
+#define B09 9
+#define B10 10
+#define NMI 13
+
+// events
+typedef struct {
+	int type;
+	s32 data;
+} event_t;
+
+enum {
+	kEventFront, kEventPollADC, kEventKeyTimer, kEventSaveFlash,
+	kEventClockNormal, kEventFtdiConnect, kEventFtdiDisconnect,
+	kEventMonomeConnect, kEventMonomeDisconnect, kEventMonomePoll,
+	kEventMonomeRefresh, kEventMonomeGridKey, kEventMidiConnect,
+	kEventMidiDisconnect, kEventMidiPacket, kEventTimer, kEventClockExt,
+	kNumEventTypes
+};
+
+extern void (*app_event_handlers[])(s32);
+bool event_post(event_t *e);
+bool event_next(event_t *e);
+void init_events(void);
+
+// timers
+typedef void (*timer_callback_t)(void *);
+
+typedef struct softTimer {
+	u32 ticksRemain;
+	u32 ticks;
+	timer_callback_t callback;
+	void *caller;
+	struct softTimer *next;
+	struct softTimer *prev;
+} softTimer_t;
+
+bool timer_add(softTimer_t *t, u32 ticks, timer_callback_t callback, void *caller);
+bool timer_remove(softTimer_t *t);
+
+// monome
+extern u8 monomeFrameDirty;
+extern u8 monomeLedBuffer[256];
+extern void (*monome_refresh)(void);
+void monome_grid_key_parse_event_data(s32 data, u8 *x, u8 *y, u8 *z);
+u8 monome_size_x(void);
+u8 monome_is_vari(void);
+void monome_set_quadrant_flag(u8 q);
+void monome_read_serial(void);
+void init_monome(void);
+
+// adc, spi, gpio
+void adc_convert(u16 (*dst)[4]);
+
+typedef struct { int unused; } avr32_spi_t;
+extern avr32_spi_t host_spi;
+#define SPI (&host_spi)
+#define DAC_SPI_NPCS 0
+int spi_selectChip(volatile avr32_spi_t *spi, u8 chip);
+int spi_unselectChip(volatile avr32_spi_t *spi, u8 chip);
+int spi_write(volatile avr32_spi_t *spi, u16 data);
+
+void gpio_set_gpio_pin(u32 pin);
+void gpio_clr_gpio_pin(u32 pin);
+int gpio_get_pin_value(u32 pin);
+
+// flash
+void *flashc_memcpy(volatile void *dst, const void *src, size_t n, bool erase);
+volatile void *flashc_memset8(volatile void *dst, u8 v, size_t n, bool erase);
+volatile void *flashc_memset32(volatile void *dst, u32 v, size_t n, bool erase);
+#define flashc_memset(d, v, w, n, e) flashc_memset8(d, v, n, e)
+
+// tc and interrupts
+typedef struct { int unused; } avr32_tc_t;
+extern avr32_tc_t host_tc;
+#define AVR32_TC host_tc
+#define AVR32_TC_IRQ1 449
+#define AVR32_INTC_INT3 3
+#define TC_WAVEFORM_SEL_UP_MODE_RC_TRIGGER 2
+#define TC_CLOCK_SOURCE_TC4 4
+
+typedef struct {
+	unsigned int channel, bswtrg, beevt, bcpc, bcpb, aswtrg, aeevt, acpc,
+		acpa, wavsel, enetrg, eevt, eevtedg, cpcdis, cpcstop, burst, clki,
+		tcclks;
+} tc_waveform_opt_t;
+
+typedef struct {
+	unsigned int etrgs, ldrbs, ldras, cpcs, cpbs, cpas, lovrs, covfs;
+} tc_interrupt_t;
+
+int tc_init_waveform(volatile avr32_tc_t *tc, const tc_waveform_opt_t *opt);
+int tc_configure_interrupts(volatile avr32_tc_t *tc, unsigned int channel, const tc_interrupt_t *irq);
+int tc_write_rc(volatile avr32_tc_t *tc, unsigned int channel, unsigned short v);
+int tc_start(volatile avr32_tc_t *tc, unsigned int channel);
+int tc_stop(volatile avr32_tc_t *tc, unsigned int channel);
+int tc_read_sr(volatile avr32_tc_t *tc, unsigned int channel);
+
+typedef void (*__int_handler)(void);
+void INTC_register_interrupt(__int_handler handler, u32 irq, u32 level);
+void irq_initialize_vectors(void);
+void register_interrupts(void);
+void cpu_irq_enable(void);
+void cpu_irq_disable(void);
+void cpu_irq_enable_level(int level);
+void cpu_irq_disable_level(int level);
+int cpu_irq_level_is_enabled(int level);
+
+u32 Get_sys_count(void);
+
+// usb, ii, init
+void midi_read(void);
+bool midi_write(const u8 *data, u32 bytes);
+void ftdi_read(void);
+void ftdi_setup(void);
+void ii_tx_queue(u8 data);
+extern void (*process_ii)(u8 *data, u8 l);
+extern void (*clock_pulse)(u8 phase);
+void init_dbg_rs232(u32 hz);
+void init_gpio(void);
+void init_tc(void);
+void init_spi(void);
+void init_adc(void);
+void init_usb_host(void);
+void init_i2c_slave(u8 addr);
+void sysclk_init(void);
+
+#define ES 0x50
+#define ES_PRESET 0
+#define ES_MODE 1
+#define ES_CLOCK 2
+#define ES_RESET 3
+#define ES_PATTERN 4
+#define ES_TRANS 5
+#define ES_STOP 6
+#define ES_TRIPLE 7
+#define ES_MAGIC 8
+
+// notes
+typedef struct {
+	u8 num;
+	u8 vel;
+} held_note_t;
+
+typedef struct {
+	u8 count;
+	held_note_t note[16];
+} note_pool_t;
+
+typedef enum { kNotePriorityLast, kNotePriorityFirst } note_priority_t;
+
+void notes_init(note_pool_t *pool);
+void notes_hold(note_pool_t *pool, u8 num, u8 vel);
+void notes_release(note_pool_t *pool, u8 num);
+const held_note_t *notes_get(note_pool_t *pool, note_priority_t p);
+
+void print_dbg(const char *s);
+void print_dbg_ulong(unsigned long n);
+void print_dbg_hex(unsigned long n);
+
+////////////////////////////////////////////////////////////////////////////////
+// test side of the mocks
+
+// simulated time, the cycle counter runs at FMCK_HZ from it
+extern u64 host_ns;
+// or, when set, from the host's own clock, for timing real code
+extern u8 host_real_clock;
+
+// dac frames: every select/unselect is one frame of spi writes
+#define HOST_SPI_MAX 4096
+extern u32 host_spi_frames;
+extern u32 host_spi_torn;		// a frame started inside another
+extern u8 host_spi_sel;
+extern u16 host_spi_log[HOST_SPI_MAX];
+extern u32 host_spi_len;
+extern void (*host_spi_hook)(void);	// runs on every spi_write
+
+// gate and other gpio edges with the time they happened
+#define HOST_EDGES 1024
+typedef struct {
+	u64 ns;
+	u32 pin;
+	u8 level;
+} host_edge_t;
+extern host_edge_t host_edge[HOST_EDGES];
+extern u32 host_edges;
+extern u8 host_pin[32];
+
+// the gate tc channel: counts at FPBA_HZ / 32 while started
+void host_tc_run(u64 ns);
+
+// interrupt level masks and the count of masked sections per level
+extern u8 host_irq_masked[4];
+extern u32 host_irq_sections[4];
+
+// adc readings handed out by adc_convert
+extern u16 host_adc[4];
+
+// midi bytes written out
+#define HOST_MIDI_MAX 32768
+extern u8 host_midi[HOST_MIDI_MAX];
+extern u32 host_midi_len;
+
+extern u32 host_flash_writes;
+
+// bytes queued for the ii master's read
+#define HOST_II_TX_MAX 256
+extern u8 host_ii_tx[HOST_II_TX_MAX];
+extern u32 host_ii_tx_len;
+
+extern int host_failed;
+
+#endif
@@ -0,0 +1,243 @@
+// ii frames against the clock timer: the receive interrupt never touches the
+// playheads, an ES_CLOCK pulse is stepped by the next clock tick and stays in
+// order with frames queued after it, and queued frames run with the playheads
+// held so a tick in the middle of one can't step them. batches against single
+// commands on a model of the bus, and ES_GET reading back the snapshot.
+
+#include "../src/main.c"
+#include "test.h"
+
+static u8 CLK[3] = { ES_CLOCK, 0, 1 };
+
+static void pattern(void) {
+	pattern_t *p = &es.p[3];
+	u8 i;
+
+	memset(p, 0, sizeof(*p));
+	p->length = 4;
+	for (i = 0; i < 4; i++) {
+		p->e[i].shape = 1;
+		p->e[i].x = i * 3;
+		p->e[i].interval = 20;
+	}
+	p->total_time = 80;
+	p->loop = 1;
+	p->rate = RATE_UNITY;
+	p->mul = p->div = 1;
+	pattern_check(p);
+}
+
+// a pulse arriving part way through the timer's ph_run: taken on the first
+// dac write of an event the timer plays
+static playhead_t before;
+static u8 took;
+
+static void pulse_in_run(void) {
+	if (took)
+		return;
+	took = 1;
+	memcpy(&before, &ph[1], sizeof(before));
+	es_ii_receive(CLK, 3);
+	CHECK(!memcmp(&before, &ph[1], sizeof(before)));
+}
+
+// what a tick in the middle of a queued frame sees
+static u8 held_in_frame;
+
+static void tick_in_frame(void) {
+	held_in_frame |= ph_hold;
+}
+
+// the bus, as the master sees it: a write is a start, the address byte, the
+// payload and a stop, 9 clocks a byte at 100 kHz
+#define N_CMDS 64
+
+static u32 bus_writes, bus_bytes;
+
+static void bus_write(u8 *data, u8 l) {
+	bus_writes++;
+	bus_bytes += 1 + l;
+	es_ii_receive(data, l);
+	check_events();
+}
+
+static u32 bus_us(void) {
+	return (bus_bytes * 9 + bus_writes * 2) * 10;
+}
+
+// the same N_CMDS commands one to a write, or four
+static void bus_run(u8 batch) {
+	static const u8 cmd[4][3] = {
+		{ ES_PH_TRANS, 1, 0 }, { ES_PH_LOOP, 1, 0 }, { ES_ARB, 0, 1 }, { ES_SW_DIV, 0, 0 }
+	};
+	u8 f[I2C_FRAME];
+	u8 i, k, l = 0;
+
+	bus_writes = bus_bytes = 0;
+	for (i = 0; i < N_CMDS; i++) {
+		memcpy(&f[l], cmd[i & 3], 3);
+		if (i & 3)
+			f[l + 2] = i & 15;
+		else
+			f[l + 2] = i / 4 % 5;
+		l += 3;
+		if (!batch || l == I2C_FRAME) {
+			bus_write(f, l);
+			l = 0;
+		}
+	}
+	CHECK(i2c_rd == i2c_wr && !i2c_overflow);
+}
+
+// a tick taken part way through a batch, on its first dac write
+static u8 ticked;
+static playhead_t mid;
+
+static void tick_in_batch(void) {
+	if (ticked)
+		return;
+	ticked = 1;
+	clockTimer_callback(NULL);
+	memcpy(&mid, &ph[1], sizeof(mid));
+}
+
+int main(void) {
+	u8 stop[3] = { ES_PH_STOP, 1, 0 };
+	u8 triple[3] = { ES_TRIPLE, 0, 1 };
+	u8 batch[9] = { ES_TRIPLE, 0, 2, ES_PH_STOP, 1, 0, ES_PH_PLAY, 1, 3 };
+	u8 get[2] = { ES_GET, 0 };
+	u8 pos, w, sw, x;
+	u32 n, single_writes, single_bytes, single_us;
+
+	VARI = 1;
+	tune_default();
+	tune_check();
+	tune_resolve();
+	ph_init();
+	process_ii = &es_ii_receive;
+	timer_add(&clockTimer, 10, &clockTimer_callback, NULL);
+	pattern();
+
+	ph_tick = 100;
+	ph_play(1, 3);
+	ph_clock(1, phClockII);
+	clockTimer_callback(NULL);
+
+	// a pulse between two ticks only counts itself
+	pos = ph[1].pos;
+	memcpy(&before, &ph[1], sizeof(before));
+	w = ii_pulse_wr;
+	es_ii_receive(CLK, 3);
+	CHECK(ii_pulse_wr == (u8)(w + 1));
+	CHECK(!memcmp(&before, &ph[1], sizeof(before)));
+
+	// and the next tick steps it
+	clockTimer_callback(NULL);
+	CHECK(ii_pulse_rd == ii_pulse_wr);
+	CHECK(ph[1].pos != pos);
+	CHECK(ph[1].gstart == ph_tick);
+
+	// one part way through ph_run leaves the playhead as the timer had it,
+	// and is stepped on the tick after
+	ph_play(2, 3);
+	ph_clock(2, phClockInt);
+	took = 0;
+	host_spi_hook = &pulse_in_run;
+	for (n = 0; !took && n < 1000; n++)
+		clockTimer_callback(NULL);
+	CHECK(took);
+	host_spi_hook = NULL;
+	CHECK(ii_pulse_rd != ii_pulse_wr);
+	pos = ph[1].pos;
+	clockTimer_callback(NULL);
+	CHECK(ii_pulse_rd == ii_pulse_wr);
+	CHECK(ph[1].pos != pos);
+	ph_stop(2);
+
+	// a stop queued behind a pulse waits for the tick to step the pulse
+	es_ii_receive(CLK, 3);
+	es_ii_receive(stop, 3);
+	CHECK(i2c_rd != i2c_wr);
+	check_events();
+	CHECK(i2c_rd != i2c_wr && ph[1].playing);
+	pos = ph[1].pos;
+	clockTimer_callback(NULL);
+	CHECK(ph[1].pos != pos);
+	check_events();
+	CHECK(i2c_rd == i2c_wr && !ph[1].playing);
+
+	// a single queued frame runs with the playheads held
+	es_ii_receive(CLK, 3);
+	es_ii_receive(triple, 3);
+	clockTimer_callback(NULL);
+	root_x = 11;
+	held_in_frame = 0;
+	host_spi_hook = &tick_in_frame;
+	check_events();
+	host_spi_hook = NULL;
+	CHECK(held_in_frame);
+	CHECK(!ph_hold);
+
+	// and while they're held a tick steps neither them nor a pulse
+	ph_play(1, 3);
+	ph_clock(1, phClockII);
+	ph_hold = 1;
+	pos = ph[1].pos;
+	es_ii_receive(CLK, 3);
+	clockTimer_callback(NULL);
+	CHECK(ph[1].pos == pos && ii_pulse_rd != ii_pulse_wr);
+	ph_hold = 0;
+	clockTimer_callback(NULL);
+	CHECK(ph[1].pos != pos && ii_pulse_rd == ii_pulse_wr);
+
+	// bus occupancy, single commands against batches of four
+	bus_run(0);
+	single_writes = bus_writes;
+	single_bytes = bus_bytes;
+	single_us = bus_us();
+	sw = es.sw_div;
+	x = ph[1].x;
+	bus_run(1);
+	printf("ii: %u commands, single %u writes %u bytes %u us, batched %u writes %u bytes %u us\n",
+		N_CMDS, single_writes, single_bytes, single_us, bus_writes, bus_bytes, bus_us());
+	CHECK(single_writes == N_CMDS && bus_writes == N_CMDS / 4);
+	CHECK(single_bytes == N_CMDS * 4 && bus_bytes == N_CMDS / 4 * 13);
+	CHECK(es.sw_div == sw && ph[1].x == x);
+
+	// a batch lands between two playhead ticks: a tick taken part way through
+	// doesn't play playhead 1 even though it's due, and the stop and play
+	// after it start the playhead over
+	ph_play(1, 3);
+	ph_clock(1, phClockInt);
+	ph[1].due = ph_tick + 1;
+	ph_next = ph_tick + 1;
+	memcpy(&before, &ph[1], sizeof(before));
+	root_x = 2;
+	ticked = 0;
+	n = ph_tick;
+	host_spi_hook = &tick_in_batch;
+	bus_write(batch, 9);
+	host_spi_hook = NULL;
+	CHECK(ticked && ph_tick == n + 1);
+	CHECK(!memcmp(&mid, &before, sizeof(mid)));
+	CHECK(ph[1].playing && ph[1].pos == 0);
+
+	// ES_GET answers from the snapshot the tick leaves, two bytes high first.
+	// past the end it reads whether playhead 0 is playing.
+	p_select = 3;
+	clockTimer_callback(NULL);
+	host_ii_tx_len = 0;
+	for (w = 0; w <= snCount; w++) {
+		get[1] = w;
+		bus_write(get, 2);
+	}
+	CHECK(host_ii_tx_len == 2 * (snCount + 1));
+	for (w = 0; w < snCount; w++)
+		CHECK(host_ii_tx[2 * w] == ii_snap[w] >> 8 && host_ii_tx[2 * w + 1] == (ii_snap[w] & 0xff));
+	CHECK(host_ii_tx[2 * snCount + 1] == ii_snap[snPlaying]);
+	CHECK(ii_snap[snPattern] == 3 && ii_snap[snLength] == 4 && ii_snap[snTotal] == 80 && ii_snap[snRate] == RATE_UNITY);
+	CHECK(ii_snap[snCv0] == aout[0].now);
+	CHECK(i2c_rd == i2c_wr);
+
+	return host_done("ii");
+}
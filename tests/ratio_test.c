@@ -0,0 +1,94 @@
+// ii clocked playback plays the recorded intervals against the measured pulse
+// period: a step covers the pattern's mean interval, mul steps to div pulses,
+// and the first step of every group lands on its pulse whatever the groove
+
+#include "../src/main.c"
+#include "test.h"
+
+#define MS(x) ((u64)(x) * 1000000)
+
+// ticks after the first pulse each event of the 7th loop fires on, with
+// ES_CLOCK every 20 ticks (200ms). the tempo is locked before it starts.
+static void run(u8 mul, u8 div, u8 groove, u32 *fired) {
+	pattern_t *p = &es.p[3];
+	u32 start, tick, events = 0;
+	u8 i, was = 0;
+
+	memset(p, 0, sizeof(*p));
+	p->length = 4;
+	p->e[0].interval = 10;
+	p->e[1].interval = 30;
+	p->e[2].interval = 20;
+	p->e[3].interval = 20;
+	p->total_time = 80;
+	p->loop = 1;
+	p->rate = RATE_UNITY;
+	pattern_check(p);
+	p->mul = mul;
+	p->div = div;
+	p->groove = groove;
+
+	timer_add(&clockTimer, 10, &clockTimer_callback, NULL);
+	memset(&clk_ii, 0, sizeof(clk_ii));
+	host_ns = 0;
+	for (i = 0; i < 8; i++) {
+		host_ns += MS(200);
+		ext_pulse(&clk_ii, Get_sys_count());
+	}
+	CHECK(clk_ii.lock == 2);
+
+	ph_tick = 5000;
+	ph_play(0, 3);
+	ph_clock(0, phClockII);
+	start = ph_tick;
+
+	for (tick = 0; events < 4 * 7; tick++) {
+		if (tick % 20 == 0) {
+			ext_pulse(&clk_ii, Get_sys_count());
+			ph_pulse();
+		}
+
+		for (; was != ph[0].pos; was = was % 4 + 1, events++)
+			if (events >= 24)
+				fired[events - 24] = ph_tick - start;
+
+		host_ns += MS(10);
+		clockTimer_callback(NULL);
+	}
+
+	ph_stop(0);
+}
+
+int main(void) {
+	u32 fired[4];
+
+	VARI = 1;
+	ph_init();
+
+	// a pulse for each 20 ticks of the pattern: played as recorded
+	run(1, 1, 0, fired);
+	CHECK(fired[0] == 480);
+	CHECK(fired[1] - fired[0] == 10 && fired[2] - fired[0] == 40 && fired[3] - fired[0] == 60);
+
+	// twice as many steps as pulses: twice as fast
+	run(2, 1, 0, fired);
+	CHECK(fired[0] == 240);
+	CHECK(fired[1] - fired[0] == 5 && fired[2] - fired[0] == 20 && fired[3] - fired[0] == 30);
+
+	// a step every other pulse: half as fast
+	run(1, 2, 0, fired);
+	CHECK(fired[0] == 960);
+	CHECK(fired[1] - fired[0] == 20 && fired[2] - fired[0] == 80 && fired[3] - fired[0] == 120);
+
+	// swung, the second event moves but the third is still on the pulse
+	run(2, 1, 1, fired);
+	CHECK(fired[0] == 240);
+	CHECK(fired[1] - fired[0] == 5 && fired[2] - fired[0] == 20);
+
+	// three steps a pulse start every group on the pulse: the event at
+	// pattern tick 60 is the first step of the second group
+	run(3, 1, 4, fired);
+	CHECK(fired[0] == 160 && fired[3] == 180);
+
+	return host_done("ratio");
+}
@@ -0,0 +1,100 @@
+// cost of a shape change: the cached slew lengths (note_shape) against
+// working them out on every change the way it was done before the cache
+// (an EXP lookup and a divide per output). host timings, so only the ratio
+// means much; the device saves the same three divides.
+
+// main.c has its own clock()
+#define clock libc_clock
+#include <time.h>
+#undef clock
+
+#include "../src/main.c"
+#include "test.h"
+
+#define CHANGES 2000000
+
+static double now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// note_shape as it was: lengths from the slew value on every change
+static void note_shape_uncached(u8 s) {
+	u8 i;
+
+	if(shape_on != (s-1)) {
+		shape_on = s-1;
+
+		for(i=0;i<3;i++) {
+			if(es.slew[shape_on][i] < SLEW_CV_OFF_THRESH) {
+				aout[i].target = es.cv[shape_on][i];
+				aout[i].slew = es.slew[shape_on][i];
+
+				slew_start(i, EXP[aout[i].slew >> 4] + 1, es.curve[i]);
+			}
+		}
+	}
+}
+
+int main(void) {
+	double t0, cached, uncached;
+	aout_t a[3];
+	u32 n;
+	u8 s, i;
+
+	srand(1);
+	for (s = 0; s < 8; s++)
+		for (i = 0; i < 3; i++) {
+			es.cv[s][i] = rand() % 4096;
+			es.slew[s][i] = rand() % SLEW_CV_OFF_THRESH;
+		}
+	slew_cache_all();
+
+	// both start the same slews
+	for (s = 1; s <= 8; s++) {
+		shape_on = 100;
+		for (i = 0; i < 3; i++)
+			aout[i].now = 2048;
+		note_shape_uncached(s);
+		memcpy(a, aout, sizeof(a));
+
+		shape_on = 100;
+		for (i = 0; i < 3; i++)
+			aout[i].now = 2048;
+		note_shape(s);
+		for (i = 0; i < 3; i++) {
+			CHECK(aout[i].step == a[i].step);
+			CHECK(abs(aout[i].delta - a[i].delta) <= 1);
+		}
+	}
+
+	// a slew changed after the cache was filled, the way the pots and cc do,
+	// is picked up by the next shape change that uses it
+	es.slew[2][1] = (es.slew[2][1] + 700) % SLEW_CV_OFF_THRESH;
+	slew_touch(2, 1);
+	CHECK(slew_stale[2] == 2);
+	shape_on = 100;
+	aout[1].now = 2048;
+	note_shape_uncached(3);
+	memcpy(a, aout, sizeof(a));
+	shape_on = 100;
+	aout[1].now = 2048;
+	note_shape(3);
+	CHECK(!slew_stale[2]);
+	CHECK(aout[1].step == a[1].step && abs(aout[1].delta - a[1].delta) <= 1);
+
+	t0 = now_ns();
+	for (n = 0; n < CHANGES; n++)
+		note_shape_uncached((n & 7) + 1);
+	uncached = (now_ns() - t0) / CHANGES;
+
+	t0 = now_ns();
+	for (n = 0; n < CHANGES; n++)
+		note_shape((n & 7) + 1);
+	cached = (now_ns() - t0) / CHANGES;
+
+	printf("shape change: %.1f ns uncached, %.1f ns cached\n", uncached, cached);
+
+	return host_done("shape");
+}
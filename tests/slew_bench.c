@@ -0,0 +1,54 @@
+// cost of a cvTimer tick with all four outputs slewing, linear against each
+// curve. host timings, so only the ratio means much. the dac writes are the
+// same in every case and are mocked out, so this is the stepping alone.
+
+// main.c has its own clock()
+#define clock libc_clock
+#include <time.h>
+#undef clock
+
+#include "../src/main.c"
+#include "test.h"
+
+#define TICKS 4000000
+
+static double now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static double per_tick(u8 curve) {
+	double t0;
+	u32 n;
+	u8 i;
+
+	t0 = now_ns();
+	for (n = 0; n < TICKS; n++) {
+		for (i = 0; i < 4; i++)
+			if (!aout[i].step) {
+				aout[i].target = aout[i].now < 2048 ? 4000 - i : 100 + i;
+				slew_start(i, 400, curve);
+			}
+		cvTimer_callback(NULL);
+		host_spi_len = 0;
+	}
+	return (now_ns() - t0) / TICKS;
+}
+
+int main(void) {
+	static const char *NAME[curveCount] = { "linear", "rc", "log", "exp" };
+	double lin, t;
+	u8 c;
+
+	slew_active = 1;
+
+	lin = per_tick(curveLin);
+	printf("slew tick, 4 outputs: %s %.1f ns\n", NAME[curveLin], lin);
+	for (c = 1; c < curveCount; c++) {
+		t = per_tick(c);
+		printf("slew tick, 4 outputs: %s %.1f ns, %.2fx linear\n", NAME[c], t, t / lin);
+	}
+
+	return host_done("slew bench");
+}
@@ -0,0 +1,45 @@
+// every slew curve, up and down, short and long: the output gets to its
+// target on exactly the tick the slew length says, and never turns back on
+// the way there
+
+#include "../src/main.c"
+#include "test.h"
+
+static void run(u8 curve, u16 from, u16 to, u16 steps) {
+	aout_t *o = &aout[2];
+	u16 ticks = slew_ticks(steps), last = from, n;
+
+	o->now = from;
+	o->target = to;
+	slew_start(2, steps, curve);
+
+	for (n = 0; o->step; n++) {
+		cvTimer_callback(NULL);
+		if (to > from)
+			CHECK(o->now >= last && o->now <= to);
+		else
+			CHECK(o->now <= last && o->now >= to);
+		last = o->now;
+	}
+
+	CHECK(n == ticks);
+	CHECK(o->now == to);
+}
+
+int main(void) {
+	static const u16 STEPS[] = { 1, 2, 3, 17, 200, 1800 };
+	u8 c, i;
+
+	slew_active = 1;
+
+	for (c = 0; c < curveCount; c++)
+		for (i = 0; i < sizeof(STEPS) / sizeof(STEPS[0]); i++) {
+			run(c, 0, 4095, STEPS[i]);
+			run(c, 4095, 0, STEPS[i]);
+			run(c, 1000, 1003, STEPS[i]);
+			run(c, 3000, 2999, STEPS[i]);
+			run(c, 2048, 2048, STEPS[i]);
+		}
+
+	return host_done("slew");
+}
@@ -0,0 +1,53 @@
+// a dac frame sent from the main loop can't be split by the clock timer
+// playing a shape of its own part way through it
+
+#include "../src/main.c"
+#include "test.h"
+
+static u32 tried, held;
+
+// the clock timer's interrupt, taken between two spi words if it isn't masked
+static void timer_irq(void) {
+	tried++;
+	if (host_irq_masked[APP_TC_IRQ_PRIORITY]) {
+		held++;
+		return;
+	}
+
+	host_irq_masked[APP_TC_IRQ_PRIORITY] = 1;
+	pattern_shape(1, 9, 2, OUT_PITCH);
+	// nothing in the interrupt may unmask its own level
+	CHECK(host_irq_masked[APP_TC_IRQ_PRIORITY]);
+	host_irq_masked[APP_TC_IRQ_PRIORITY] = 0;
+}
+
+int main(void) {
+	u8 i;
+
+	VARI = 1;
+	port_active = 0;
+
+	// a midi note from the main loop, with the timer due on every word
+	host_spi_hook = &timer_irq;
+	for (i = 0; i < 16; i++) {
+		note_hold();
+		note_pitch(pitch_bent(40 + i));
+		note_commit();
+	}
+	host_spi_hook = NULL;
+
+	CHECK(host_spi_frames > 0);
+	CHECK(tried > 0 && held == tried);
+	CHECK(host_spi_torn == 0);
+	CHECK(!host_irq_masked[APP_TC_IRQ_PRIORITY]);
+
+	// from the timer itself it writes as before, and leaves the level masked
+	tried = held = 0;
+	host_spi_hook = &timer_irq;
+	host_irq_masked[APP_TC_IRQ_PRIORITY] = 1;
+	pattern_shape(1, 4, 5, OUT_PITCH);
+	CHECK(host_irq_masked[APP_TC_IRQ_PRIORITY]);
+	CHECK(host_spi_torn == 0);
+
+	return host_done("spi");
+}
@@ -0,0 +1,194 @@
+// sysex dump and load round trips through the firmware, plus the files
+// tools/es_sysex.py is checked against (see the makefile)
+
+#include "../src/main.c"
+#include "test.h"
+
+static u8 image[sizeof(es_set)];
+
+static void feed(const u8 *b, u32 len) {
+	while (len--)
+		sysex_feed(*b++);
+}
+
+static void send_seq(u8 cmd, u16 seq) {
+	u8 b[8];
+	u8 n = sysex_header(b, cmd);
+
+	b[n++] = seq & 0x7f;
+	b[n++] = seq >> 7;
+	b[n++] = 0xf7;
+	feed(b, n);
+}
+
+// dump a preset or pattern, acking every message. returns the message bytes.
+static u32 dump(u8 kind, u8 preset, u8 pattern, u8 *out, u32 max) {
+	u8 req[9];
+	u8 n = sysex_header(req, sxRequest);
+	u32 start, len = 0;
+
+	req[n++] = kind;
+	req[n++] = preset;
+	req[n++] = pattern;
+	req[n++] = 0xf7;
+
+	host_midi_len = 0;
+	feed(req, n);
+
+	while (1) {
+		start = len;
+		len = host_midi_len;
+		if (len == start || host_midi[len - 1] != 0xf7)
+			break;
+		if (host_midi[start + 4] == sxDone)
+			break;
+		send_seq(sxAck, host_midi[start + 8] | (host_midi[start + 9] << 7));
+	}
+
+	memcpy(out, host_midi, len);
+	return len;
+}
+
+// the host side encoder, the same thing tools/es_sysex.py does
+static u32 encode(u8 kind, u8 preset, u8 pattern, const u8 *src, u16 size, u8 *out) {
+	u32 len = 0;
+	u16 seq, off, check;
+	u8 *b, n, c;
+
+	for (seq = 0, off = 0; ; seq++, off += c) {
+		b = &out[len];
+		c = min(SYSEX_CHUNK, size - off);
+		n = sysex_header(b, c ? sxChunk : sxDone);
+		b[n++] = kind;
+		b[n++] = preset;
+		b[n++] = pattern;
+		b[n++] = seq & 0x7f;
+		b[n++] = seq >> 7;
+		if (c)
+			n += sysex_pack(&b[n], src + off, c);
+		else {
+			check = sysex_check(src, size);
+			b[n++] = check & 0x7f;
+			b[n++] = (check >> 7) & 0x7f;
+			b[n++] = check >> 14;
+		}
+		b[n] = sysex_sum(&b[5], n - 5);
+		n++;
+		b[n++] = 0xf7;
+		len += n;
+		if (!c)
+			return len;
+	}
+}
+
+// decode a dump back to raw bytes, 0 on any bad message
+static u32 decode(const u8 *m, u32 len, u8 *out) {
+	u32 i = 0, n = 0, end;
+	u16 check;
+
+	while (i < len) {
+		for (end = i; m[end] != 0xf7; end++);
+		if (sysex_sum(&m[i + 5], end - i - 6) != m[end - 1])
+			return 0;
+		if (m[i + 4] == sxDone) {
+			check = m[i + 10] | (m[i + 11] << 7) | (m[i + 12] << 14);
+			return sysex_check(out, n) == check ? n : 0;
+		}
+		n += sysex_unpack(&out[n], &m[i + 10], end - i - 11);
+		i = end + 1;
+	}
+
+	return 0;
+}
+
+static u8 msgs[32768];
+static u8 data[sizeof(msgs)];
+
+static void write_file(const char *name, const u8 *b, u32 len) {
+	FILE *f = fopen(name, "wb");
+
+	fwrite(b, 1, len, f);
+	fclose(f);
+}
+
+int main(void) {
+	u32 i, len;
+	pattern_t *p;
+
+	srand(1);
+	for (i = 0; i < sizeof(image); i++)
+		image[i] = rand();
+
+	// pack/unpack is lossless for every length a chunk can have
+	for (i = 1; i <= SYSEX_CHUNK; i++) {
+		u8 packed[80];
+		u8 n = sysex_pack(packed, image, i);
+		CHECK(sysex_unpack(data, packed, n) == i);
+		CHECK(!memcmp(data, image, i));
+	}
+
+	preset_select = 0;
+
+	// dump of preset 2 decodes to what's in flash
+	memcpy((void *)&flashy.es[2], image, sizeof(image));
+	len = dump(sxPreset, 2, 0, msgs, sizeof(msgs));
+	CHECK(len > sizeof(image));
+	CHECK(decode(msgs, len, data) == sizeof(image));
+	CHECK(!memcmp(data, image, sizeof(image)));
+	CHECK(sysex.state == sxIdle);
+	write_file("preset.syx", msgs, len);
+	write_file("preset.bin", image, sizeof(image));
+
+	// the host encoder makes the same messages the firmware sends
+	CHECK(encode(sxPreset, 2, 0, image, sizeof(image), data) == len);
+	CHECK(!memcmp(data, msgs, len));
+
+	// and loading them into preset 3 gives the same image
+	len = encode(sxPreset, 3, 0, image, sizeof(image), msgs);
+	host_midi_len = 0;
+	feed(msgs, len);
+	CHECK(!memcmp((void *)&flashy.es[3], image, sizeof(image)));
+	CHECK(host_midi[host_midi_len - 4] == sxAck);
+
+	// a transfer cut short leaves the preset alone
+	memset((void *)&flashy.es[4], 0x5a, sizeof(es_set));
+	len = encode(sxPreset, 4, 0, image, sizeof(image), msgs);
+	for (i = 0; i < len && msgs[len - 1 - i] != 0xf0; i++);
+	feed(msgs, len - i - 1);
+	for (i = 0; i < sizeof(es_set); i++)
+		if (((u8 *)&flashy.es[4])[i] != 0x5a)
+			break;
+	CHECK(i == sizeof(es_set));
+
+	// so does a bad whole-image check
+	len = encode(sxPreset, 4, 0, image, sizeof(image), msgs);
+	msgs[len - 3] ^= 1;
+	msgs[len - 2] ^= 1;
+	host_midi_len = 0;
+	feed(msgs, len);
+	CHECK(((u8 *)&flashy.es[4])[0] == 0x5a);
+	CHECK(host_midi[host_midi_len - 4] == sxNak);
+
+	// a pattern load into the current preset replaces the working pattern
+	// and drops history and the seek index that pointed at the old one
+	p = (pattern_t *)image;
+	memset(p, 0, sizeof(pattern_t));
+	p->length = 3;
+	p->total_time = 30;
+	p->rate = 256;
+	for (i = 0; i < 3; i++) {
+		p->e[i].shape = 1;
+		p->e[i].interval = 10;
+	}
+	undo_push(5, 0, es.p[5].length);
+	CHECK(undo_count == 1);
+	seek_valid = 1;
+	len = encode(sxPattern, 0, 5, image, sizeof(pattern_t), msgs);
+	feed(msgs, len);
+	CHECK(!memcmp((void *)&flashy.es[0].p[5], image, sizeof(pattern_t)));
+	CHECK(es.p[5].length == 3 && es.p[5].total_time == 30);
+	CHECK(undo_count == 0);
+	CHECK(seek_valid == 0);
+
+	return host_done("sysex");
+}
@@ -0,0 +1,12 @@
+// included by each test right after ../src/main.c
+
+#undef main
+
+#define CHECK(c) do { if (!(c)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+		host_failed++; } } while (0)
+
+static int host_done(const char *name) {
+	printf("%s: %s\n", name, host_failed ? "FAIL" : "ok");
+	return host_failed != 0;
+}
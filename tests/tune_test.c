@@ -0,0 +1,138 @@
+// tunings: the default matches SEMI, notes above the dac's range are only
+// clamped after a bend, rows can't be zero steps apart, the quantizer covers
+// the whole dac in any tuning, and a custom scale plays in order however it
+// was entered while keeping the order it was entered in
+
+#include "../src/main.c"
+#include "test.h"
+
+// every bin lands on the nearest note of the tuning at or under 4095
+static void quant_nearest(void) {
+	u16 b, v, n, best;
+	u32 e, be;
+
+	for (b = 0; b < 512; b++) {
+		v = (b << 3) + 4;
+		best = 0;
+		be = 0xffffffff;
+		for (n = 0; tune_cv(n) <= 4095; n++) {
+			e = abs((s32)tune_cv(n) - v);
+			if (e < be) {
+				be = e;
+				best = tune_cv(n);
+			}
+		}
+		CHECK(qtab[b] == best);
+	}
+}
+
+// notes never go down, so the grid and the quantizer can walk them
+static void ascending(void) {
+	u8 i;
+
+	for (i = 1; i < 128; i++)
+		CHECK(tune[i] >= tune[i - 1]);
+	CHECK(tune_cv(128) >= tune[127]);
+}
+
+int main(void) {
+	u8 cmd[3] = { ES_ROW, 0, 0 };
+	u8 i, x, y;
+
+	tune_default();
+	tune_check();
+	tune_resolve();
+
+	// 12 edo is SEMI, including the top notes past 4095
+	for (i = 0; i < 128; i++)
+		CHECK(tune[i] == SEMI[i]);
+	CHECK(tune[127] > 4095);
+
+	// a bend down brings the top note back into range rather than starting
+	// from 4095, and the clamp still holds going up
+	pitch_offset = -300;
+	CHECK(pitch_bent(127) == SEMI[127] - 300);
+	pitch_offset = 300;
+	CHECK(pitch_bent(127) == 4095);
+	pitch_offset = -300;
+	CHECK(pitch_bent(0) == 0);
+	pitch_offset = 0;
+
+	// keys are sent as they are, so they stay clamped
+	for (y = 0; y < 8; y++)
+		for (x = 0; x < 16; x++)
+			CHECK(key_cv[y][x] <= 4095);
+
+	// a row of 0 would put every row on the same notes
+	es.tune.row = 5;
+	es_process_ii(cmd, 3);
+	CHECK(es.tune.row == 5);
+	cmd[2] = 7;
+	es_process_ii(cmd, 3);
+	CHECK(es.tune.row == 7);
+
+	es.tune.row = 0;
+	tune_check();
+	CHECK(es.tune.row == 5);
+
+	// 19 edo: tune[] stops at 127 degrees, 2737 codes, but the quantizer
+	// still finds notes to the top
+	es.tune.kind = tunEdo;
+	es.tune.edo = 19;
+	es.qscale = 0;
+	tune_check();
+	tune_resolve();
+	CHECK(tune[127] == 2737);
+	quant_nearest();
+	CHECK(qtab[511] > 4000);
+
+	// and 5 edo, where 128 degrees are far past the top
+	es.tune.edo = 5;
+	tune_resolve();
+	quant_nearest();
+
+	// a custom scale entered out of order plays in order, and is stored as
+	// it was entered
+	es.tune.kind = tunCustom;
+	es.tune.degrees = 4;
+	es.tune.custom[0] = 0;
+	es.tune.custom[1] = 3000;
+	es.tune.custom[2] = 1000;
+	es.tune.custom[3] = 2000;
+	tune_check();
+	tune_resolve();
+	CHECK(es.tune.custom[1] == 3000 && es.tune.custom[2] == 1000 && es.tune.custom[3] == 2000);
+	CHECK(tune[1] == 100 && tune[2] == 200 && tune[3] == 300);
+	ascending();
+	quant_nearest();
+
+	// an ii edit changes the degree it names, whatever order it plays in
+	cmd[0] = ES_TUNE_SET;
+	cmd[1] = 1 << 4 | 3500 >> 8;
+	cmd[2] = 3500 & 0xff;
+	es_process_ii(cmd, 3);
+	CHECK(es.tune.custom[1] == 3500 && es.tune.custom[2] == 1000 && es.tune.custom[3] == 2000);
+	CHECK(tune[3] == 350);
+	cmd[1] = 1 << 4 | 500 >> 8;
+	cmd[2] = 500 & 0xff;
+	es_process_ii(cmd, 3);
+	CHECK(es.tune.custom[1] == 500);
+	CHECK(tune[1] == 50 && tune[3] == 200);
+	ascending();
+	quant_nearest();
+
+	// ES_TUNE from the default to 16 custom degrees: the four unset degrees
+	// are 0 and play at the bottom of each octave, the rest stay put
+	tune_default();
+	cmd[0] = ES_TUNE;
+	cmd[1] = tunCustom;
+	cmd[2] = 16;
+	es_process_ii(cmd, 3);
+	CHECK(es.tune.kind == tunCustom && es.tune.degrees == 16);
+	CHECK(es.tune.custom[1] == 341 && es.tune.custom[12] == 0);
+	CHECK(tune[4] == 0 && tune[5] == 34 && tune[16] == 409);
+	ascending();
+	quant_nearest();
+
+	return host_done("tune");
+}
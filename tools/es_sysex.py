@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""earthsea preset/pattern sysex files
+
+    es_sysex.py decode dump.syx out.bin
+    es_sysex.py encode in.bin out.syx --preset 2 [--pattern 5]
+
+decode checks every message and the whole-image check and writes the raw
+preset or pattern. encode makes the messages a load needs, to be sent one at
+a time, waiting for the module's ack in between. the message format is
+described above sysex_pack in src/main.c; the version byte has to match the
+firmware's FIRSTRUN_KEY, which is read from there unless --version is given.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+MANUFACTURER = 0x7D
+DEVICE = 0x45
+CHUNK = 56
+REQUEST, CHUNK_CMD, ACK, NAK, DONE = 1, 2, 3, 4, 5
+PRESET, PATTERN = 0, 1
+
+
+def firmware_version():
+    src = os.path.join(os.path.dirname(__file__), "..", "src", "main.c")
+    with open(src) as f:
+        m = re.search(r"#define\s+FIRSTRUN_KEY\s+(0x[0-9a-fA-F]+|\d+)", f.read())
+    if not m:
+        sys.exit("FIRSTRUN_KEY not found in %s, pass --version" % src)
+    return int(m.group(1), 0) & 0x7F
+
+
+def pack(data):
+    out = bytearray()
+    for i in range(0, len(data), 7):
+        group = data[i:i + 7]
+        out.append(sum(((b >> 7) & 1) << j for j, b in enumerate(group)))
+        out += bytes(b & 0x7F for b in group)
+    return out
+
+
+def unpack(data):
+    out = bytearray()
+    for i in range(0, len(data), 8):
+        hi = data[i]
+        out += bytes(b | (((hi >> j) & 1) << 7) for j, b in enumerate(data[i + 1:i + 8]))
+    return out
+
+
+def check(data):
+    s1 = s2 = 0
+    for b in data:
+        s1 = (s1 + b) % 255
+        s2 = (s2 + s1) % 255
+    return (s2 << 8) | s1
+
+
+def message(version, cmd, body):
+    return bytes([0xF0, MANUFACTURER, DEVICE, version, cmd]) + bytes(body) + \
+        bytes([sum(body) & 0x7F, 0xF7])
+
+
+def encode(data, version, kind, preset, pattern):
+    msgs = []
+    seq = 0
+    for off in range(0, len(data), CHUNK):
+        head = [kind, preset, pattern, seq & 0x7F, seq >> 7]
+        msgs.append(message(version, CHUNK_CMD, head + list(pack(data[off:off + CHUNK]))))
+        seq += 1
+    c = check(data)
+    head = [kind, preset, pattern, seq & 0x7F, seq >> 7]
+    msgs.append(message(version, DONE, head + [c & 0x7F, (c >> 7) & 0x7F, c >> 14]))
+    return b"".join(msgs)
+
+
+def decode(syx):
+    data = bytearray()
+    for raw in syx.split(b"\xf7"):
+        if not raw:
+            continue
+        if raw[:3] != bytes([0xF0, MANUFACTURER, DEVICE]):
+            sys.exit("not an earthsea message")
+        cmd, body = raw[4], raw[5:]
+        if sum(body[:-1]) & 0x7F != body[-1]:
+            sys.exit("bad message sum at seq %d" % (body[3] | body[4] << 7))
+        if cmd == CHUNK_CMD:
+            data += unpack(body[5:-1])
+        elif cmd == DONE:
+            c = body[5] | body[6] << 7 | body[7] << 14
+            if check(data) != c:
+                sys.exit("whole-image check doesn't match")
+            return bytes(data)
+    sys.exit("dump has no end message")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("cmd", choices=["encode", "decode"])
+    ap.add_argument("src")
+    ap.add_argument("dst")
+    ap.add_argument("--preset", type=int, default=0)
+    ap.add_argument("--pattern", type=int)
+    ap.add_argument("--version", type=lambda v: int(v, 0))
+    a = ap.parse_args()
+
+    with open(a.src, "rb") as f:
+        src = f.read()
+
+    if a.cmd == "decode":
+        out = decode(src)
+    else:
+        version = a.version if a.version is not None else firmware_version()
+        kind = PRESET if a.pattern is None else PATTERN
+        out = encode(src, version, kind, a.preset, a.pattern or 0)
+
+    with open(a.dst, "wb") as f:
+        f.write(out)
+
+
+if __name__ == "__main__":
+    main()